@@ -0,0 +1,767 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bench-ctrie.hpp"
+#include "log_arena.hpp"
+#include "otf_ctrie.hpp"
+
+using namespace std;
+
+// The tracer and destructor tables as they were before dispatch was
+// generated from ctrie_node_types: each trace function builds and
+// returns a list<void*>, and both tables hold std::function. Only the
+// node types are spelled through otf_ctrie_types.
+struct baseline
+{
+  using types = otf_ctrie_types<ctrie_string, int, local_hash<ctrie_string>>;
+
+  using inode_type = types::inode_type;
+  using cnode_type = types::cnode_type;
+  using snode_type = types::snode_type;
+  using tnode_type = types::tnode_type;
+  using lnode_type = types::lnode_type;
+  using failure_type = types::failure_type;
+  using rdcss_desc = types::rdcss_desc;
+
+  static list<void*> trace_inode(void* ptr)
+  {
+    auto& in = *reinterpret_cast<inode_type*>(ptr);
+
+    auto mn = in.main.load(std::memory_order_relaxed);
+
+    if(mn) {
+      return { mn->derived_ptr() };
+    } else
+      return {};
+  }
+
+  static list<void*> trace_cnode(void* ptr)
+  {
+    auto cn = reinterpret_cast<cnode_type*>(ptr);
+
+    list<void*> result;
+
+    if(auto cpn = cn->prev.load(std::memory_order_relaxed))
+      result.push_front(cpn->derived_ptr());
+
+    if(cn->arr.data())
+      result.push_front(reinterpret_cast<void*>(cn->arr.data()));
+
+    for(auto& p : cn->arr)
+      if(p.get())
+	result.push_front(reinterpret_cast<void*>(p->derived_ptr()));
+
+    return result;
+  }
+
+  static list<void*> trace_snode(void* ptr)
+  {
+    auto& sn = *reinterpret_cast<snode_type*>(ptr);
+
+    if(sn.k.data())
+      return { reinterpret_cast<void*>(const_cast<char*>(sn.k.data())) };
+    else
+      return {};
+  }
+
+  static list<void*> trace_tnode(void* ptr)
+  {
+    auto& tn = *reinterpret_cast<tnode_type*>(ptr);
+
+    list<void*> result;
+
+    if(auto tpn = tn.prev.load(std::memory_order_relaxed))
+      result.push_front(tpn->derived_ptr());
+
+    if(tn.sn)
+      result.push_front(const_cast<void*>(reinterpret_cast<const void*>(tn.sn)));
+
+    return result;
+  }
+
+  static list<void*> trace_lnode(void* ptr)
+  {
+    using pl_type = plist_node<snode_type*>;
+
+    auto& ln = *reinterpret_cast<lnode_type*>(ptr);
+
+    const auto& n = *reinterpret_cast<const std::atomic<pl_type*>*>(&ln.contents);
+    const void* v = reinterpret_cast<const void*>(n.load(std::memory_order_relaxed));
+
+    list<void*> result;
+
+    if(auto lpn = ln.prev.load(std::memory_order_relaxed))
+      result.push_front(lpn->derived_ptr());
+
+    if(v)
+      result.push_front(const_cast<void*>(v));
+
+    return result;
+  }
+
+  static list<void*> trace_failure(void* ptr)
+  {
+    auto& fn = *reinterpret_cast<failure_type*>(ptr);
+
+    if(fn.prev.get())
+      return { fn.prev->derived_ptr() };
+    else
+      return {};
+  }
+
+  static list<void*> trace_branch_vector(void*)
+  {
+    return {};
+  }
+
+  static list<void*> trace_string(void*)
+  {
+    return {};
+  }
+
+  static list<void*> trace_plist_node(void* ptr)
+  {
+    using internal_pl_type = snode_type*;
+    using pl_type = const plist_node<internal_pl_type>;
+
+    const auto& n  = *reinterpret_cast<pl_type*>(ptr);
+    const auto& nd = static_cast<const internal_pl_type&>(n.data);
+
+    list<void*> result;
+
+    if(n.next)
+      result.push_front(reinterpret_cast<void*>(n.next));
+
+    if(nd)
+      result.push_front(const_cast<void*>(reinterpret_cast<const void*>(nd)));
+
+    return result;
+  }
+
+  static list<void*> trace_rdcss_desc(void* ptr)
+  {
+    list<void*> result;
+
+    auto rd_ptr = reinterpret_cast<rdcss_desc*>(ptr);
+
+    if(rd_ptr->ov.get())
+      result.push_front(rd_ptr->ov.get()->derived_ptr());
+
+    if(rd_ptr->expected_main.get())
+      result.push_front(rd_ptr->expected_main.get()->derived_ptr());
+
+    if(rd_ptr->nv.get())
+      result.push_front(rd_ptr->nv.get()->derived_ptr());
+
+    return result;
+  }
+
+  static const std::function<list<void*>(void*)> tracer_table[];
+
+  static list<void*> get_derived_ptrs(impl_details::underlying_header_t h, void* root)
+  {
+    using namespace impl_details;
+    std::ptrdiff_t d = reinterpret_cast<std::ptrdiff_t>(root);
+    return tracer_table[(h & header_tag_mask) >> color_bits](reinterpret_cast<void*>(d));
+  }
+
+  template <typename T>
+  static void destroy_type(void* ptr)
+  {
+    T* t_ptr = reinterpret_cast<T*>(ptr);
+    t_ptr->~T();
+  }
+
+  static void destroy_vector(void*)
+  {}
+
+  static const std::function<void(void*)> destructor_table[];
+
+  inline static void destroy(impl_details::underlying_header_t h, impl_details::header_t* ptr)
+  {
+    using namespace impl_details;
+
+    std::ptrdiff_t d = reinterpret_cast<std::ptrdiff_t>(ptr) + header_size;
+    destructor_table[(h & header_tag_mask) >> color_bits](reinterpret_cast<void*>(d));
+  }
+};
+
+const std::function<list<void*>(void*)> baseline::tracer_table[] = {
+  trace_inode,
+  trace_cnode,
+  trace_snode,
+  trace_tnode,
+  trace_lnode,
+  trace_failure,
+  trace_branch_vector,
+  trace_string,
+  trace_plist_node,
+  trace_rdcss_desc
+};
+
+const std::function<void(void*)> baseline::destructor_table[] = {
+  destroy_type<inode_type>,
+  destroy_type<cnode_type>,
+  destroy_type<snode_type>,
+  destroy_type<tnode_type>,
+  destroy_type<lnode_type>,
+  destroy_type<failure_type>,
+  destroy_vector,
+  destroy_vector,
+  destroy_type<plist_node<snode_type>>,
+  destroy_type<rdcss_desc>
+};
+
+// keeps the results of timed loops observable.
+static volatile size_t hash_sink;
+
+// Marks each object rounds times, through the baseline's list-building
+// table and through the generated dispatch pushing onto a gray vector.
+static void bench_mark(const vector<heap_object>& objs, size_t rounds)
+{
+  vector<void*> gray;
+  gray.reserve(64);
+
+  double baseline_secs = time_secs([&]() {
+      for(size_t r = 0; r < rounds; ++r)
+	for(auto& obj : objs) {
+	  for(void* q : baseline::get_derived_ptrs(obj.h, obj.p))
+	    gray.push_back(q);
+	  gray.clear();
+	}
+    });
+
+  double dispatch_secs = time_secs([&]() {
+      for(size_t r = 0; r < rounds; ++r)
+	for(auto& obj : objs) {
+	  otf_ctrie_tracer::visit_derived_ptrs(obj.h, obj.p, [&gray](void* q) {
+	      gray.push_back(q);
+	    });
+	  gray.clear();
+	}
+    });
+
+  report("mark", "baseline", objs.size() * rounds, baseline_secs);
+  report("mark", "dispatch", objs.size() * rounds, dispatch_secs);
+}
+
+// Sweeping destroys unreachable objects, so the live ones are first
+// copied out the way the write barrier's log snapshots are. The copies
+// are made apart from the log arena, which the collector frees.
+static vector<heap_object> copy_fixed_size_objects(const vector<heap_object>& objs)
+{
+  using namespace impl_details;
+
+  vector<heap_object> copies;
+
+  for(auto& obj : objs) {
+    size_t n = otf_ctrie_tracer::size_of(obj.h);
+
+    if(n == 0)
+      continue;
+
+    char* buf = reinterpret_cast<char*>(aligned_alloc(alignof(header_t), header_size + n));
+    new(reinterpret_cast<header_t*>(buf)) header_t(obj.h);
+
+    std::memcpy(buf + header_size, obj.p, n);
+    copies.push_back({ obj.h, buf + header_size });
+  }
+
+  return copies;
+}
+
+static void free_copies(const vector<heap_object>& copies)
+{
+  for(auto& c : copies)
+    free(reinterpret_cast<void*>(reinterpret_cast<std::ptrdiff_t>(c.p) - impl_details::header_size));
+}
+
+static void bench_sweep(const vector<heap_object>& objs)
+{
+  using namespace impl_details;
+
+  auto baseline_copies = copy_fixed_size_objects(objs);
+  auto dispatch_copies = copy_fixed_size_objects(objs);
+
+  double baseline_secs = time_secs([&]() {
+      for(auto& c : baseline_copies)
+	baseline::destroy(c.h,
+			  reinterpret_cast<header_t*>(reinterpret_cast<std::ptrdiff_t>(c.p)
+						      - header_size));
+    });
+
+  double dispatch_secs = time_secs([&]() {
+      for(auto& c : dispatch_copies)
+	otf_ctrie_policy::destroy(c.h,
+				  reinterpret_cast<header_t*>(reinterpret_cast<std::ptrdiff_t>(c.p)
+							      - header_size));
+    });
+
+  report("sweep", "baseline", baseline_copies.size(), baseline_secs);
+  report("sweep", "dispatch", dispatch_copies.size(), dispatch_secs);
+
+  free_copies(baseline_copies);
+  free_copies(dispatch_copies);
+}
+
+// Rewrites every key of a trie of num_keys, rounds times, through
+// insert, so each store goes through the real otf_write_barrier: into
+// the cnode copies an update builds, fresh and so never logged, and by
+// GCAS into the inodes the trie already held, logged whenever a cycle is
+// tracing. The keys are short enough to be stored inline, so no update
+// allocates a string. Reports the updates per second, and the log copies
+// made and elided per update.
+static void bench_barrier(const char* state, size_t num_keys, size_t rounds)
+{
+  otf_ctrie ct;
+  fill_ctrie(ct, num_keys);
+
+  vector<string> keys;
+
+  for(size_t i = 0; i < num_keys; ++i)
+    keys.push_back(bench_key(i));
+
+  gc_totals before = gc_stats::totals();
+
+  double secs = time_secs([&]() {
+      for(size_t r = 0; r < rounds; ++r)
+	for(size_t i = 0; i < num_keys; ++i)
+	  ct.insert(ctrie_string(keys[i].c_str()), static_cast<int>(r));
+    });
+
+  gc_totals after = gc_stats::totals();
+  double updates = double(num_keys) * rounds;
+
+  report("barrier/update", state, num_keys * rounds, secs);
+
+  std::printf("%-28s %-12s %14.3f copied/update %8.3f elided/update\n", "barrier/logs", state,
+	      (after.log_ptrs_copied - before.log_ptrs_copied) / updates,
+	      (after.log_copies_elided - before.log_copies_elided) / updates);
+}
+
+// Copies num_copies objects of the fixed size node types into logs and
+// drops them again, rounds times, through aligned_alloc and free and
+// through a log arena of its own, ending a cycle after each round.
+static void bench_log_arena(size_t num_copies, size_t rounds)
+{
+  using node_types = otf_ctrie_tracer::node_types;
+
+  vector<size_t> sizes;
+
+  for(size_t size : node_types::sizes)
+    if(size > 0)
+      sizes.push_back(impl_details::header_size + size);
+
+  size_t max_size = *std::max_element(sizes.begin(), sizes.end());
+  unique_ptr<std::max_align_t[]> source(new std::max_align_t[max_size / sizeof(std::max_align_t) + 1]());
+  const void* object = source.get();
+
+  vector<void*> copies;
+  copies.reserve(num_copies);
+
+  log_arena arena;
+
+  double malloc_secs = time_secs([&]() {
+      for(size_t r = 0; r < rounds; ++r) {
+	for(size_t i = 0; i < num_copies; ++i) {
+	  size_t n = sizes[i % sizes.size()];
+	  void* buf = aligned_alloc(alignof(impl_details::header_t), n);
+
+	  std::memcpy(buf, object, n);
+	  copies.push_back(buf);
+	}
+
+	for(void* c : copies)
+	  free(c);
+
+	copies.clear();
+      }
+    });
+
+  double arena_secs = time_secs([&]() {
+      for(size_t r = 0; r < rounds; ++r) {
+	for(size_t i = 0; i < num_copies; ++i) {
+	  size_t n = sizes[i % sizes.size()];
+	  void* buf = arena.allocate(n);
+
+	  std::memcpy(buf, object, n);
+	  copies.push_back(buf);
+	}
+
+	arena.cycle_ended();
+	copies.clear();
+      }
+    });
+
+  report("log-copy", "aligned_alloc", num_copies * rounds, malloc_secs);
+  report("log-copy", "arena", num_copies * rounds, arena_secs);
+}
+
+// The byte at a time hash local_hash used before hash_bytes.
+static size_t legacy_hash(const char* p, size_t n)
+{
+  size_t seed = 0;
+
+  for(size_t i = 0; i < n; ++i)
+    seed ^= p[i] + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+
+  return seed;
+}
+
+static void bench_hash()
+{
+  const size_t key_lengths[] = { 1, 8, 16, 64, 256, 1024, 2500 };
+  const size_t num_hashes = 1 << 16;
+
+  for(size_t len : key_lengths) {
+    ctrie_string key(len, 'k');
+    hashed_ctrie_string cached_key(len, 'k');
+    size_t sink = 0;
+
+    double legacy_secs = time_secs([&]() {
+	for(size_t i = 0; i < num_hashes; ++i)
+	  sink += legacy_hash(key.data(), key.size());
+      });
+
+    double word_secs = time_secs([&]() {
+	for(size_t i = 0; i < num_hashes; ++i)
+	  sink += local_hash<ctrie_string>()(key);
+      });
+
+    double cached_secs = time_secs([&]() {
+	for(size_t i = 0; i < num_hashes; ++i)
+	  sink += local_hash<hashed_ctrie_string>()(cached_key);
+      });
+
+    hash_sink = sink;
+
+    string bench = "hash/len=" + to_string(len);
+
+    report(bench.c_str(), "byte", num_hashes, legacy_secs);
+    report(bench.c_str(), "word", num_hashes, word_secs);
+    report(bench.c_str(), "cached", num_hashes, cached_secs);
+  }
+}
+
+static void bench_interleaved_lookup()
+{
+  const size_t trie_sizes[] = { 1 << 10, 1 << 14, 1 << 18, 1 << 21 };
+  const size_t num_lookups = 1 << 20;
+
+  for(size_t trie_size : trie_sizes) {
+    otf_ctrie ct;
+    fill_ctrie(ct, trie_size);
+
+    vector<string> keys;
+    keys.reserve(num_lookups);
+
+    for(size_t i = 0; i < num_lookups; ++i)
+      keys.push_back(bench_key(hash_impl::fmix64(i) % trie_size));
+
+    vector<string_view> views(keys.begin(), keys.end());
+    vector<const int*> results(views.size());
+
+    double sequential_secs = time_secs([&]() {
+	for(size_t i = 0; i < views.size(); ++i)
+	  results[i] = ct.lookup(views[i]);
+      });
+
+    double interleaved_secs = time_secs([&]() {
+	ct.lookup_many_interleaved(views.begin(), views.end(), results.begin());
+      });
+
+    string bench = "lookup/size=" + to_string(trie_size);
+
+    report(bench.c_str(), "sequential", num_lookups, sequential_secs);
+    report(bench.c_str(), "interleaved", num_lookups, interleaved_secs);
+  }
+}
+
+// The copy ref_string made before recoloring skipped matching colors:
+// the header is stored whether or not it changes.
+static ctrie_string legacy_copy(const ctrie_string& key)
+{
+  using namespace impl_details;
+
+  auto hp = reinterpret_cast<header_t*>(const_cast<char*>(key.data()) - header_size);
+  auto h = hp->load(std::memory_order_relaxed);
+
+  hp->store(((h >> color_bits) << color_bits) | static_cast<underlying_header_t>(mt()->mut_color().c),
+	    std::memory_order_relaxed);
+
+  return ctrie_string::borrow(key.data(), key.size());
+}
+
+// Lookups of a few hot keys, longer than the inline length so that they
+// share string objects, from 1 up to all cores. "by-value" pays the
+// header store every copy used to make; "by-ref" is the lookup as it is.
+static void bench_hot_keys()
+{
+  const size_t num_hot_keys = 16;
+  const size_t num_lookups = 1 << 20;
+
+  otf_ctrie ct;
+  vector<ctrie_string> hot_keys;
+
+  for(size_t i = 0; i < num_hot_keys; ++i) {
+    string key = "hot-key-" + to_string(i) + string(32, '.');
+
+    hot_keys.emplace_back(key.c_str());
+    ct.insert(hot_keys.back(), static_cast<int>(i));
+  }
+
+  // the keys' strings are roots alongside the ctrie's.
+  deque<scoped_root> key_roots;
+
+  for(auto& key : hot_keys)
+    key_roots.emplace_back(&key, [](const void* k) -> void* {
+	return const_cast<char*>(static_cast<const ctrie_string*>(k)->data());
+      });
+
+  auto run = [&](size_t num_threads, bool by_value) {
+    return time_secs([&]() {
+	vector<future<void>> readers;
+
+	for(size_t t = 0; t < num_threads; ++t)
+	  readers.push_back(async(launch::async, [&, t]() {
+		size_t hits = 0;
+
+		for(size_t i = 0; i < num_lookups; ++i) {
+		  const ctrie_string& key = hot_keys[(i + t) % num_hot_keys];
+		  hits += (by_value ? ct.lookup(legacy_copy(key)) : ct.lookup(key)) != nullptr;
+		}
+
+		hash_sink = hits;
+		mt().reset();
+	      }));
+
+	for(auto& reader : readers)
+	  while(reader.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+	    poll_for_sync();
+      });
+  };
+
+  const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for(size_t num_threads = 1; ; num_threads = std::min(2 * num_threads, max_threads)) {
+    string bench = "hot-keys/threads=" + to_string(num_threads);
+
+    report(bench.c_str(), "by-value", num_threads * num_lookups, run(num_threads, true));
+    report(bench.c_str(), "by-ref", num_threads * num_lookups, run(num_threads, false));
+
+    if(num_threads == max_threads)
+      break;
+  }
+}
+
+template <class Ctrie>
+static void bench_root_width(const char* name, size_t trie_size)
+{
+  const size_t num_lookups = 1 << 20;
+
+  Ctrie ct;
+
+  double insert_secs = time_secs([&]() {
+      fill_ctrie(ct, trie_size);
+    });
+
+  double lookup_secs = time_secs([&]() {
+      for(size_t i = 0; i < num_lookups; ++i)
+	ct.lookup(string_view(bench_key(hash_impl::fmix64(i) % trie_size)));
+    });
+
+  string bench = "root/size=" + to_string(trie_size);
+
+  report(bench.c_str(), (string(name) + "/insert").c_str(), trie_size, insert_secs);
+  report(bench.c_str(), (string(name) + "/lookup").c_str(), num_lookups, lookup_secs);
+}
+
+// Lookups through a ctrie whose root is one cnode against ones whose
+// root level is 2^8, 2^12 and 2^16 subtries wide, at depths of about
+// three to five levels.
+static void bench_root_widths()
+{
+  const size_t trie_sizes[] = { 1 << 14, 1 << 18, 1 << 21 };
+
+  for(size_t trie_size : trie_sizes) {
+    bench_root_width<otf_ctrie>("narrow", trie_size);
+    bench_root_width<otf_wide_ctrie<8>>("wide-8", trie_size);
+    bench_root_width<otf_wide_ctrie<12>>("wide-12", trie_size);
+    bench_root_width<otf_wide_ctrie<16>>("wide-16", trie_size);
+  }
+}
+
+// Inserts num_inserts fresh keys per thread into ct from num_threads
+// threads, returning the seconds taken.
+static double timed_writers(otf_ctrie& ct, size_t num_threads, size_t num_inserts)
+{
+  return time_secs([&]() {
+      vector<future<void>> writers;
+
+      for(size_t t = 0; t < num_threads; ++t)
+	writers.push_back(async(launch::async, [&ct, t, num_inserts]() {
+	      for(size_t i = 0; i < num_inserts; ++i)
+		ct.insert(ctrie_string(("w" + to_string(t) + "-" + to_string(i)).c_str()), i);
+
+	      mt().reset();
+	    }));
+
+      for(auto& writer : writers)
+	writer.get();
+    });
+}
+
+static void bench_snapshot_writers(size_t trie_size)
+{
+  const size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t num_inserts = 1 << 16;
+  const size_t num_ops = num_threads * num_inserts;
+
+  {
+    otf_ctrie ct;
+    fill_ctrie(ct, trie_size);
+
+    report("writers/no-snapshot", "insert", num_ops, timed_writers(ct, num_threads, num_inserts));
+  }
+
+  {
+    otf_ctrie ct;
+    fill_ctrie(ct, trie_size);
+
+    otf_ctrie ss = ct.snapshot();
+
+    double secs = timed_writers(ct, num_threads, num_inserts);
+
+    for(size_t i = 0; i < trie_size; i += 16)
+      ss.lookup(bench_key(i));
+
+    report("writers/snapshot", "insert", num_ops, secs);
+  }
+}
+
+// Reading every key back through a snapshot() and a snapshot_view()
+// of a trie that's been written to since. The live side pays the same
+// for either; lookups through snapshot() also renew each inode they pass
+// on the snapshot side, which the view doesn't.
+static void bench_snapshot_reads(size_t trie_size)
+{
+  const size_t num_inserts = 1 << 16;
+
+  auto read_back = [trie_size](auto& ss) {
+    return time_secs([&]() {
+	for(size_t i = 0; i < trie_size; ++i)
+	  ss.lookup(bench_key(i));
+      });
+  };
+
+  {
+    otf_ctrie ct;
+    fill_ctrie(ct, trie_size);
+
+    otf_ctrie ss = ct.snapshot();
+    timed_writers(ct, 1, num_inserts);
+
+    report("snapshot-reads/snapshot", "lookup", trie_size, read_back(ss));
+  }
+
+  {
+    otf_ctrie ct;
+    fill_ctrie(ct, trie_size);
+
+    otf_ctrie_view ss = ct.snapshot_view();
+    timed_writers(ct, 1, num_inserts);
+
+    report("snapshot-reads/snapshot-view", "lookup", trie_size, read_back(ss));
+  }
+}
+
+// Scanning the roots of 256 live ctries, before and after 2^16
+// snapshots of them have been taken and dropped.
+static void bench_root_scan(size_t num_scans)
+{
+  const size_t num_tries = 256;
+  const size_t num_snapshots = 1 << 16;
+
+  vector<unique_ptr<otf_ctrie>> tries;
+
+  for(size_t i = 0; i < num_tries; ++i)
+    tries.emplace_back(new otf_ctrie);
+
+  const auto& registry = root_registry::local();
+
+  auto scan = [&]() {
+    return time_secs([&]() {
+	for(size_t i = 0; i < num_scans; ++i) {
+	  list<void*> roots = registry->ct_callback();
+
+	  hash_sink = reinterpret_cast<uintptr_t>(*roots.begin());
+	}
+      });
+  };
+
+  report("root-scan/tries=256", "fresh", num_scans, scan());
+
+  for(size_t i = 0; i < num_snapshots; ++i)
+    otf_ctrie ss = tries[i % num_tries]->snapshot();
+
+  report("root-scan/tries=256", "after-snapshots", num_scans, scan());
+}
+
+int main(int argc, char** argv)
+{
+  size_t num_keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 18;
+
+  bench_log_arena(num_keys, 10);
+
+  gc::initialize();
+
+  // no cycle runs before the collector starts, so every barriered store
+  // takes the idle path. Afterwards the collector cycles back to back,
+  // and the barrier logs whenever one is tracing.
+  bench_barrier("idle", num_keys, 10);
+
+  std::future<void> collector_thread = std::async([]() {
+      gc::collector->template run<otf_ctrie_policy, otf_ctrie_tracer>();
+    });
+
+  bench_barrier("marking", num_keys, 10);
+
+  {
+    otf_ctrie ct;
+    fill_ctrie(ct, num_keys);
+
+    // nothing is fresh once a handshake has been answered.
+    poll_for_sync();
+
+    auto objs = reachable_objects(ct);
+
+    bench_mark(objs, 10);
+    bench_sweep(objs);
+  }
+
+  bench_hash();
+  bench_interleaved_lookup();
+  bench_root_widths();
+  bench_root_scan(1 << 14);
+  bench_snapshot_writers(num_keys);
+  bench_snapshot_reads(num_keys);
+  bench_hot_keys();
+
+  mt().reset();
+
+  gc::collector->stop();
+  collector_thread.get();
+  gc::collector->template destroy<otf_ctrie_policy>();
+
+  return 0;
+}
@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bench-ctrie.hpp"
+#include "ctrie.hpp"
+#include "otf_ctrie.hpp"
+
+using namespace std;
+
+// Throughput and latency of mixed workloads over the managed ctrie, the
+// unmanaged ctrie it is built on and a sharded, mutex protected
+// unordered_map. Every combination of the parameters below is run, and
+// each run prints one CSV row to stdout. Parameters are overridden by
+// comma separated lists, as in
+//
+//   bench-throughput --sizes=1000,100000000 --threads=1,8 --lengths=16
+//
+// The defaults stop at 1M entries; 100M entries of 2500 byte keys won't
+// fit in memory, so the larger sizes are best run with short keys. Keys
+// of a few bytes can't be distinct past 64^len entries, and tables of
+// them are cut to that size; the CSV row gives the size actually run.
+//
+// --soft-limit-mb sets the gc_pacing soft limit.
+
+struct workload_mix
+{
+  unsigned read, write, remove;
+};
+
+struct bench_params
+{
+  vector<size_t> sizes = { 1000, 10000, 100000, 1000000 };
+  vector<size_t> threads;
+  // from one byte, through the longest key stored inline in its snode
+  // and the shortest stored apart, to the longest in test-ctrie.cpp.
+  vector<size_t> lengths = { 1,
+			     OTF_CTRIE_INLINE_KEY_LEN,
+			     OTF_CTRIE_INLINE_KEY_LEN + 1,
+			     64, 256, 1024, 2500 };
+  vector<workload_mix> mixes = { { 100, 0, 0 }, { 90, 5, 5 }, { 80, 10, 10 }, { 50, 25, 25 } };
+  vector<string> tables = { "otf", "unmanaged", "sharded" };
+  size_t ops = 1 << 20;
+  gc_pacing pacing;
+};
+
+// one in latency_sample operations is timed individually.
+static const size_t latency_sample = 16;
+
+static volatile size_t hit_sink;
+
+static vector<size_t> parse_sizes(const char* s)
+{
+  vector<size_t> v;
+
+  for(char* end; *s; s = *end ? end + 1 : end)
+    v.push_back(std::strtoull(s, &end, 10));
+
+  return v;
+}
+
+static vector<workload_mix> parse_mixes(const char* s)
+{
+  vector<workload_mix> v;
+
+  for(char* end; *s; s = *end ? end + 1 : end) {
+    workload_mix m;
+
+    m.read   = std::strtoul(s, &end, 10);
+    m.write  = std::strtoul(end + 1, &end, 10);
+    m.remove = std::strtoul(end + 1, &end, 10);
+
+    v.push_back(m);
+  }
+
+  return v;
+}
+
+static vector<string> parse_names(const char* s)
+{
+  vector<string> v;
+  string_view sv(s);
+
+  while(!sv.empty()) {
+    size_t comma = std::min(sv.find(','), sv.size());
+
+    v.emplace_back(sv.substr(0, comma));
+    sv.remove_prefix(std::min(comma + 1, sv.size()));
+  }
+
+  return v;
+}
+
+static bench_params parse_params(int argc, char** argv)
+{
+  bench_params p;
+
+  for(size_t t = 1; t < std::thread::hardware_concurrency(); t *= 2)
+    p.threads.push_back(t);
+
+  p.threads.push_back(std::max(1u, std::thread::hardware_concurrency()));
+
+  for(int i = 1; i < argc; ++i) {
+    const char* eq = std::strchr(argv[i], '=');
+
+    if(!eq) {
+      std::fprintf(stderr, "bench-throughput: ignoring %s\n", argv[i]);
+      continue;
+    }
+
+    string_view opt(argv[i], eq - argv[i]);
+
+    if(opt == "--sizes")
+      p.sizes = parse_sizes(eq + 1);
+    else if(opt == "--threads")
+      p.threads = parse_sizes(eq + 1);
+    else if(opt == "--lengths")
+      p.lengths = parse_sizes(eq + 1);
+    else if(opt == "--mixes")
+      p.mixes = parse_mixes(eq + 1);
+    else if(opt == "--tables")
+      p.tables = parse_names(eq + 1);
+    else if(opt == "--ops")
+      p.ops = std::strtoull(eq + 1, nullptr, 10);
+    else if(opt == "--soft-limit-mb")
+      p.pacing.soft_limit_bytes = std::strtoull(eq + 1, nullptr, 10) << 20;
+    else
+      std::fprintf(stderr, "bench-throughput: unknown option %s\n", argv[i]);
+  }
+
+  return p;
+}
+
+// n distinct keys of len bytes: bench_key(i) padded to len, or where
+// that's too long, i spelled in len base 64 digits. There are only 64^len
+// keys of the second kind, so a table of more is cut down to that many.
+static vector<string> make_keys(size_t n, size_t len)
+{
+  static const char digits[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-_";
+
+  vector<string> keys;
+
+  if(n > 0 && len < bench_key(n - 1).size()) {
+    if(6 * len < 64)
+      n = std::min<size_t>(n, size_t(1) << (6 * len));
+
+    keys.reserve(n);
+
+    for(size_t i = 0; i < n; ++i) {
+      string key(len, '0');
+
+      for(size_t j = 0, k = i; j < len; ++j, k >>= 6)
+	key[j] = digits[k & 63];
+
+      keys.push_back(std::move(key));
+    }
+
+    return keys;
+  }
+
+  keys.reserve(n);
+
+  for(size_t i = 0; i < n; ++i) {
+    string key = bench_key(i);
+    key.resize(std::max(len, key.size()), '.');
+
+    keys.push_back(std::move(key));
+  }
+
+  return keys;
+}
+
+struct otf_table
+{
+  const vector<string>& keys;
+  otf_ctrie ct;
+
+  otf_table(const vector<string>& keys_) : keys(keys_)
+  {
+    for(size_t i = 0; i < keys.size(); ++i)
+      insert(i);
+  }
+
+  inline bool lookup(size_t i)
+  {
+    return ct.lookup(string_view(keys[i]));
+  }
+
+  inline void insert(size_t i)
+  {
+    ct.insert(ctrie_string(keys[i].c_str()), static_cast<int>(i));
+  }
+
+  inline void remove(size_t i)
+  {
+    ct.remove(string_view(keys[i]));
+  }
+
+  // retires the worker's mutator so the collector stops waiting on it.
+  static void leave()
+  {
+    mt().reset();
+  }
+};
+
+struct unmanaged_table
+{
+  const vector<string>& keys;
+  ctrie<string, int> ct;
+
+  unmanaged_table(const vector<string>& keys_) : keys(keys_)
+  {
+    for(size_t i = 0; i < keys.size(); ++i)
+      insert(i);
+  }
+
+  inline bool lookup(size_t i)
+  {
+    return ct.lookup(keys[i]);
+  }
+
+  inline void insert(size_t i)
+  {
+    ct.insert(keys[i], static_cast<int>(i));
+  }
+
+  inline void remove(size_t i)
+  {
+    ct.remove(keys[i]);
+  }
+
+  static void leave()
+  {}
+};
+
+struct sharded_table
+{
+  static const size_t num_shards = 64;
+
+  struct shard
+  {
+    std::mutex m;
+    std::unordered_map<string_view, int> map;
+  };
+
+  const vector<string>& keys;
+  std::unique_ptr<shard[]> shards;
+
+  // keys outlive the table, so the maps hold views of them.
+  inline shard& shard_of(size_t i)
+  {
+    return shards[std::hash<string_view>()(keys[i]) % num_shards];
+  }
+
+  sharded_table(const vector<string>& keys_)
+    : keys(keys_), shards(new shard[num_shards])
+  {
+    for(size_t i = 0; i < keys.size(); ++i)
+      insert(i);
+  }
+
+  inline bool lookup(size_t i)
+  {
+    shard& s = shard_of(i);
+    std::lock_guard<std::mutex> lock(s.m);
+
+    return s.map.find(keys[i]) != s.map.end();
+  }
+
+  inline void insert(size_t i)
+  {
+    shard& s = shard_of(i);
+    std::lock_guard<std::mutex> lock(s.m);
+
+    s.map[keys[i]] = static_cast<int>(i);
+  }
+
+  inline void remove(size_t i)
+  {
+    shard& s = shard_of(i);
+    std::lock_guard<std::mutex> lock(s.m);
+
+    s.map.erase(keys[i]);
+  }
+
+  static void leave()
+  {}
+};
+
+struct run_result
+{
+  double secs;
+  vector<uint64_t> latencies_ns;
+};
+
+template <class Table>
+static run_result run_mix(Table& table, size_t num_keys, const workload_mix& mix,
+			  size_t num_threads, size_t num_ops)
+{
+  using clock = std::chrono::steady_clock;
+
+  vector<vector<uint64_t>> latencies(num_threads);
+  size_t ops_per_thread = num_ops / num_threads;
+  size_t hits = 0;
+  std::mutex hits_m;
+
+  auto worker = [&](size_t t) {
+    uint64_t state = hash_impl::fmix64(t + 1);
+    size_t local_hits = 0;
+
+    latencies[t].reserve(ops_per_thread / latency_sample + 1);
+
+    for(size_t n = 0; n < ops_per_thread; ++n) {
+      uint64_t r = state = hash_impl::fmix64(state);
+      size_t i = (r >> 8) % num_keys;
+      unsigned op = r % 100;
+
+      bool timed = n % latency_sample == 0;
+      auto start = timed ? clock::now() : clock::time_point();
+
+      if(op < mix.read)
+	local_hits += table.lookup(i);
+      else if(op < mix.read + mix.write)
+	table.insert(i);
+      else
+	table.remove(i);
+
+      if(timed)
+	latencies[t].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>
+			       (clock::now() - start).count());
+    }
+
+    Table::leave();
+
+    std::lock_guard<std::mutex> lock(hits_m);
+    hits += local_hits;
+  };
+
+  double secs = time_secs([&]() {
+      vector<future<void>> workers;
+
+      for(size_t t = 0; t < num_threads; ++t)
+	workers.push_back(async(launch::async, worker, t));
+
+      // the main mutator answers handshakes while the workers run.
+      for(auto& w : workers)
+	while(w.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+	  poll_for_sync();
+
+      for(auto& w : workers)
+	w.get();
+    });
+
+  run_result result { secs, {} };
+
+  for(auto& ls : latencies)
+    result.latencies_ns.insert(result.latencies_ns.end(), ls.begin(), ls.end());
+
+  std::sort(result.latencies_ns.begin(), result.latencies_ns.end());
+
+  hit_sink = hits;
+
+  return result;
+}
+
+static uint64_t percentile(const vector<uint64_t>& sorted, double p)
+{
+  if(sorted.empty())
+    return 0;
+
+  return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+template <class Table>
+static void bench_table(const char* name, const bench_params& p,
+			const vector<string>& keys, size_t len)
+{
+  Table table(keys);
+
+  for(auto& mix : p.mixes)
+    for(size_t num_threads : p.threads) {
+      num_threads = std::max<size_t>(1, num_threads);
+
+      run_result r = run_mix(table, keys.size(), mix, num_threads, p.ops);
+      size_t ops = p.ops / num_threads * num_threads;
+
+      std::printf("%s,%zu,%zu,%u/%u/%u,%zu,%zu,%.6f,%.0f,%llu,%llu,%llu,%llu\n",
+		  name, keys.size(), len, mix.read, mix.write, mix.remove,
+		  num_threads, ops, r.secs, ops / r.secs,
+		  (unsigned long long) percentile(r.latencies_ns, 0.5),
+		  (unsigned long long) percentile(r.latencies_ns, 0.9),
+		  (unsigned long long) percentile(r.latencies_ns, 0.99),
+		  (unsigned long long) percentile(r.latencies_ns, 0.999));
+      std::fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv)
+{
+  bench_params p = parse_params(argc, argv);
+
+  gc_pacer::configure(p.pacing);
+  gc::initialize();
+
+  std::future<void> collector_thread = std::async([]() {
+      gc::collector->template run<otf_ctrie_policy, otf_ctrie_tracer>();
+    });
+
+  std::printf("table,size,key_length,mix,threads,ops,secs,ops_per_sec,"
+	      "p50_ns,p90_ns,p99_ns,p999_ns\n");
+
+  for(size_t size : p.sizes)
+    for(size_t len : p.lengths) {
+      vector<string> keys = make_keys(size, len);
+
+      for(auto& table : p.tables) {
+	if(table == "otf")
+	  bench_table<otf_table>("otf", p, keys, len);
+	else if(table == "unmanaged")
+	  bench_table<unmanaged_table>("unmanaged", p, keys, len);
+	else if(table == "sharded")
+	  bench_table<sharded_table>("sharded", p, keys, len);
+	else
+	  std::fprintf(stderr, "bench-throughput: unknown table %s\n", table.c_str());
+      }
+    }
+
+  mt().reset();
+
+  gc::collector->stop();
+  collector_thread.get();
+  gc::collector->template destroy<otf_ctrie_policy>();
+
+  return 0;
+}
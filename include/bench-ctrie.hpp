@@ -0,0 +1,82 @@
+#ifndef BENCH_CTRIE_HPP_INCLUDED
+#define BENCH_CTRIE_HPP_INCLUDED
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "gc.hpp"
+#include "otf_ctrie.hpp"
+
+using namespace otf_gc;
+
+template <typename F>
+double time_secs(F&& f)
+{
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  return elapsed.count();
+}
+
+inline void report(const char* bench, const char* variant, size_t ops, double secs)
+{
+  std::printf("%-28s %-12s %14.0f ops/s\n", bench, variant, ops / secs);
+}
+
+struct heap_object
+{
+  impl_details::underlying_header_t h;
+  void* p;
+};
+
+inline impl_details::underlying_header_t header_of(void* p)
+{
+  using namespace impl_details;
+
+  auto hp = reinterpret_cast<header_t*>(reinterpret_cast<std::ptrdiff_t>(p) - header_size);
+  return hp->load(std::memory_order_relaxed);
+}
+
+// Every object reachable from the root of ct, found by tracing.
+inline std::vector<heap_object> reachable_objects(otf_ctrie& ct)
+{
+  std::vector<heap_object> objs;
+  std::vector<void*> gray;
+  std::unordered_set<void*> marked;
+
+  gray.push_back(ct.root_ptr());
+
+  while(!gray.empty()) {
+    void* p = gray.back();
+    gray.pop_back();
+
+    if(!p || !marked.insert(p).second)
+      continue;
+
+    auto h = header_of(p);
+    objs.push_back({ h, p });
+
+    otf_ctrie_tracer::visit_derived_ptrs(h, p, [&gray](void* q) {
+	gray.push_back(q);
+      });
+  }
+
+  return objs;
+}
+
+inline std::string bench_key(size_t i)
+{
+  return "key-" + std::to_string(i);
+}
+
+template <class Ctrie>
+inline void fill_ctrie(Ctrie& ct, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    ct.insert(ctrie_string(bench_key(i).c_str()), static_cast<int>(i));
+}
+#endif
@@ -0,0 +1,50 @@
+#ifndef CTRIE_BITS_HPP_INCLUDED
+#define CTRIE_BITS_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// How a cnode branching on LevelBits bits of the hash per level locates
+// a branch: the level's bits index a bitmap of 2^LevelBits bits, and the
+// branch's position in the cnode's array is the count of bits set below.
+template <unsigned LevelBits>
+struct ctrie_bits
+{
+  static_assert(LevelBits >= 1 && LevelBits <= 5,
+		"kl_ctrie's cnode bitmaps are 32 bits wide.");
+
+  using bitmap_type = uint32_t;
+
+  static const unsigned fan_out = 1u << LevelBits;
+
+  static const unsigned hash_bits = 8 * sizeof(size_t);
+
+  // the levels it takes to consume a whole hash. index(hc, lev) is only
+  // defined for lev < hash_bits.
+  static const unsigned max_depth = (hash_bits + LevelBits - 1) / LevelBits;
+
+  inline static unsigned index(size_t hc, unsigned lev)
+  {
+    return (hc >> lev) & (fan_out - 1);
+  }
+
+  inline static bitmap_type flag(unsigned idx)
+  {
+    return bitmap_type(1) << idx;
+  }
+
+  // the number of bits of bmp set below bit idx.
+  inline static unsigned position(bitmap_type bmp, unsigned idx)
+  {
+#if defined(__BMI2__)
+    return __builtin_popcount(_bzhi_u32(bmp, idx));
+#else
+    return __builtin_popcount(bmp & (flag(idx) - 1));
+#endif
+  }
+};
+#endif
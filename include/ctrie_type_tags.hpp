@@ -1,6 +1,9 @@
 #ifndef CTRIE_TYPE_TAGS_HPP_INCLUDED
 #define CTRIE_TYPE_TAGS_HPP_INCLUDED
 
+#include <cstddef>
+#include <cstdint>
+
 #include "ctrie.hpp"
 #include "plist.hpp"
 
@@ -26,6 +29,7 @@ struct ctrie_type_info
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Misc_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = false;
 };
   
 template <typename K,
@@ -37,6 +41,7 @@ struct ctrie_type_info<inode<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Inode_t;
   static const size_t num_log_ptrs = 1;
+  static const bool variable_size = false;
 };
 
 template <typename K,
@@ -48,6 +53,7 @@ struct ctrie_type_info<cnode<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Cnode_t;
   static const size_t num_log_ptrs = 1;
+  static const bool variable_size = false;
 };
 
 template <typename K,
@@ -59,6 +65,7 @@ struct ctrie_type_info<snode<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Snode_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = false;
 };
 
 template <typename K,
@@ -70,6 +77,7 @@ struct ctrie_type_info<tnode<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Tnode_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = false;
 };
 
 template <typename K,
@@ -81,6 +89,7 @@ struct ctrie_type_info<lnode<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Lnode_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = false;
 };
 
 template <typename K,
@@ -92,6 +101,7 @@ struct ctrie_type_info<failure<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Fnode_t;
   static const size_t num_log_ptrs = 1;
+  static const bool variable_size = false;
 };
 
 template <typename K,
@@ -103,6 +113,7 @@ struct ctrie_type_info<Barrier<branch<K, V, Hash, Alloc, Barrier>*>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::BV_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = true;
 };
 
 template <typename K,
@@ -114,6 +125,7 @@ struct ctrie_type_info<plist_node<snode<K, V, Hash, Alloc, Barrier>>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Plnode_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = false;
 };
 
 template <>
@@ -121,6 +133,7 @@ struct ctrie_type_info<char>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::SV_t;
   static const size_t num_log_ptrs = 0;
+  static const bool variable_size = true;
 };
 
 template <typename K,
@@ -132,6 +145,64 @@ struct ctrie_type_info<rdcss_descriptor<K, V, Hash, Alloc, Barrier>>
 {
   static const ctrie_internal_types header_value = ctrie_internal_types::Rdnode_t;
   static const size_t num_log_ptrs = 1;
+  static const bool variable_size = false;
+};
+
+template <class T>
+struct ctrie_type_tag
+{
+  using type = T;
+};
+
+// A list of the managed types, ordered by header value. Dispatching on a
+// header tag expands into a chain of comparisons against constants, which
+// the compiler lowers to a jump table with each arm inlined.
+template <class... Ts>
+class ctrie_type_list
+{
+private:
+  static constexpr bool in_header_order()
+  {
+    const ctrie_internal_types tags[] = { ctrie_type_info<Ts>::header_value... };
+
+    for(size_t i = 0; i < sizeof...(Ts); ++i)
+      if(static_cast<size_t>(tags[i]) != i)
+	return false;
+
+    return true;
+  }
+public:
+  static constexpr size_t num_log_ptrs[] = { ctrie_type_info<Ts>::num_log_ptrs... };
+
+  // Variable sized types (vectors) store their length in the header.
+  static constexpr size_t sizes[] = {
+    (ctrie_type_info<Ts>::variable_size ? 0 : sizeof(Ts))...
+  };
+
+  template <typename F>
+  inline static void dispatch(uint8_t tag, F&& f)
+  {
+    static_assert(in_header_order(), "ctrie_type_list must be ordered by header value.");
+
+    (void) ((tag == static_cast<uint8_t>(ctrie_type_info<Ts>::header_value)
+	     && (f(ctrie_type_tag<Ts>()), true)) || ...);
+  }
 };
 
+template <typename K,
+	  typename V,
+	  class Hash,
+	  template <class> class Alloc,
+	  template <class> class Barrier>
+using ctrie_node_types = ctrie_type_list<inode<K, V, Hash, Alloc, Barrier>,
+					 cnode<K, V, Hash, Alloc, Barrier>,
+					 snode<K, V, Hash, Alloc, Barrier>,
+					 tnode<K, V, Hash, Alloc, Barrier>,
+					 lnode<K, V, Hash, Alloc, Barrier>,
+					 failure<K, V, Hash, Alloc, Barrier>,
+					 Barrier<branch<K, V, Hash, Alloc, Barrier>*>,
+					 char,
+					 plist_node<snode<K, V, Hash, Alloc, Barrier>>,
+					 rdcss_descriptor<K, V, Hash, Alloc, Barrier>>;
+
 #endif
@@ -0,0 +1,142 @@
+#ifndef GC_PACER_HPP_INCLUDED
+#define GC_PACER_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "gc_stats.hpp"
+
+struct gc_pacing
+{
+  // Mutators polling while the heap is above this are held back, polling
+  // still, until a cycle brings it under or max_assist_wait passes. 0
+  // sets no limit.
+  uint64_t soft_limit_bytes = 0;
+  std::chrono::microseconds max_assist_wait { 1000 };
+};
+
+// Paces the mutators against the collector. collect runs a cycle from a
+// mutator, and throttle, called from poll_for_sync, holds mutators back
+// at the soft limit. Both work from the mutator's side alone: the
+// collector starts its cycles back to back from its own loop, which
+// takes no trigger, so there is no growth or allocation rate policy for
+// when one starts.
+//
+// Heap sizes come from gc_stats; with OTF_CTRIE_GC_STATS off the heap
+// reads as empty and mutators are never throttled.
+class gc_pacer
+{
+private:
+  struct state
+  {
+    std::mutex m;
+
+    gc_pacing pacing;
+
+    std::atomic<bool> over_limit { false };
+
+    // pacing.soft_limit_bytes, readable without the lock.
+    std::atomic<uint64_t> soft_limit { 0 };
+  };
+
+  static state& st()
+  {
+    static state s;
+    return s;
+  }
+
+  // samples the heap, returning true if it's over the soft limit.
+  static bool over_soft_limit()
+  {
+    state& s = st();
+    gc_heap_usage usage = gc_stats::heap_usage();
+    uint64_t limit = s.soft_limit.load(std::memory_order_relaxed);
+    bool over = limit > 0 && usage.live() >= limit;
+
+    s.over_limit.store(over, std::memory_order_release);
+
+    return over;
+  }
+public:
+  // the polls a mutator makes between samples of the heap while it's
+  // under the soft limit.
+  static constexpr unsigned throttle_interval = 64;
+
+  static void configure(const gc_pacing& p)
+  {
+    state& s = st();
+    std::lock_guard<std::mutex> lock(s.m);
+
+    s.pacing = p;
+    s.soft_limit.store(p.soft_limit_bytes, std::memory_order_relaxed);
+
+    if(p.soft_limit_bytes == 0)
+      s.over_limit.store(false, std::memory_order_release);
+  }
+
+  static gc_pacing pacing()
+  {
+    state& s = st();
+    std::lock_guard<std::mutex> lock(s.m);
+
+    return s.pacing;
+  }
+
+  // Returns once a cycle that started after the call has ended. The
+  // caller is a mutator: poll answers the collector's handshakes, and
+  // epoch() reads something that changes at the handshake starting each
+  // cycle, as the mutator's allocation color does. The first change
+  // starts a cycle that sees the caller's garbage, and the second starts
+  // the next, so that cycle is over.
+  template <typename Poll, typename Epoch>
+  static void collect(Poll poll, Epoch epoch)
+  {
+    auto last = epoch();
+    unsigned changes = 0;
+
+    while(changes < 2) {
+      poll();
+
+      auto e = epoch();
+
+      if(e != last) {
+	last = e;
+	++changes;
+      }
+
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+
+  // Holds a polling mutator back while the heap is over the soft limit,
+  // polling meanwhile, for at most max_assist_wait. Each mutator samples
+  // the heap itself: every throttle_interval polls while it's under the
+  // limit, and on every poll while it's over.
+  template <typename Poll>
+  inline static void throttle(Poll poll)
+  {
+    state& s = st();
+
+    if(s.soft_limit.load(std::memory_order_relaxed) == 0)
+      return;
+
+    static thread_local unsigned polls = 0;
+
+    if(++polls % throttle_interval != 0 && !s.over_limit.load(std::memory_order_acquire))
+      return;
+
+    if(!over_soft_limit())
+      return;
+
+    auto deadline = gc_stats::clock::now() + pacing().max_assist_wait;
+
+    do {
+      poll();
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    } while(over_soft_limit() && gc_stats::clock::now() < deadline);
+  }
+};
+#endif
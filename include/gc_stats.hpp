@@ -0,0 +1,497 @@
+#ifndef GC_STATS_HPP_INCLUDED
+#define GC_STATS_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ctrie_type_tags.hpp"
+
+// Define OTF_CTRIE_GC_STATS to 0 to compile the counters out.
+#ifndef OTF_CTRIE_GC_STATS
+#define OTF_CTRIE_GC_STATS 1
+#endif
+
+enum class gc_phase : uint8_t
+{
+  handshake = 0x00,
+  mark,
+  sweep
+};
+
+static constexpr size_t num_gc_phases = 3;
+static constexpr size_t num_ctrie_types = static_cast<size_t>(ctrie_internal_types::Misc_t) + 1;
+
+struct gc_type_stats
+{
+  uint64_t objects_allocated = 0, bytes_allocated = 0;
+  uint64_t objects_marked = 0, bytes_marked = 0;
+  uint64_t objects_freed = 0, bytes_freed = 0;
+};
+
+// Counts since the collector started, or over one cycle as returned by
+// gc_stats::last_cycle(). Byte counts include each object's header and
+// log pointers.
+struct gc_totals
+{
+  uint64_t cycles = 0;
+  uint64_t phase_ns[num_gc_phases] = {};
+
+  // polls of the mutators, and the time they spent in them.
+  uint64_t polls = 0;
+  uint64_t poll_wait_ns = 0;
+
+  // objects copied into the write barrier logs by copy_obj, and the
+  // log_ptr calls turned away because their objects were freshly
+  // allocated.
+  uint64_t log_ptrs_copied = 0;
+  uint64_t log_copies_elided = 0;
+
+  gc_type_stats types[num_ctrie_types];
+
+  double phase_secs(gc_phase p) const
+  {
+    return phase_ns[static_cast<size_t>(p)] / 1e9;
+  }
+};
+
+// Bytes allocated and freed in the managed heap since the collector
+// started, headers and log pointers included.
+struct gc_heap_usage
+{
+  uint64_t allocated = 0, freed = 0;
+
+  uint64_t live() const
+  {
+    return allocated > freed ? allocated - freed : 0;
+  }
+};
+
+// Statistics of the collector and its mutators. Each thread bumps its
+// own counters with relaxed stores, and they're only summed when read,
+// so the counters stay on in production builds.
+class gc_stats
+{
+private:
+  struct counters
+  {
+    std::atomic<uint64_t> polls, poll_wait_ns, log_ptrs_copied, log_copies_elided;
+
+    std::atomic<uint64_t> objects_allocated[num_ctrie_types], bytes_allocated[num_ctrie_types];
+    std::atomic<uint64_t> objects_marked[num_ctrie_types], bytes_marked[num_ctrie_types];
+    std::atomic<uint64_t> objects_freed[num_ctrie_types], bytes_freed[num_ctrie_types];
+
+    counters()
+    {
+      polls.store(0, std::memory_order_relaxed);
+      poll_wait_ns.store(0, std::memory_order_relaxed);
+      log_ptrs_copied.store(0, std::memory_order_relaxed);
+      log_copies_elided.store(0, std::memory_order_relaxed);
+
+      for(size_t t = 0; t < num_ctrie_types; ++t) {
+	objects_allocated[t].store(0, std::memory_order_relaxed);
+	bytes_allocated[t].store(0, std::memory_order_relaxed);
+	objects_marked[t].store(0, std::memory_order_relaxed);
+	bytes_marked[t].store(0, std::memory_order_relaxed);
+	objects_freed[t].store(0, std::memory_order_relaxed);
+	bytes_freed[t].store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  // Every counters block ever handed out. A thread's block is recycled
+  // when it exits, keeping its counts, so the set stays as large as the
+  // most threads alive at once.
+  struct registry
+  {
+    std::mutex m;
+    std::vector<std::unique_ptr<counters>> all;
+    std::vector<counters*> free;
+
+    // The phase of the collector's current cycle, or num_gc_phases
+    // before its first. It only moves forward until the next cycle
+    // opens, so the hot paths test it without the lock; the rest is
+    // guarded by m.
+    std::atomic<uint8_t> phase { num_gc_phases };
+    std::atomic<int64_t> last_sample_ns { 0 };
+    int64_t phase_start_ns = 0;
+
+    // the cycles opened, bumped as each takes its first roots.
+    std::atomic<uint64_t> opened { 0 };
+
+    uint64_t cycles = 0;
+    uint64_t phase_ns[num_gc_phases] = {};
+    gc_totals at_last_cycle, last_cycle;
+  };
+
+  static registry& reg()
+  {
+    static registry r;
+    return r;
+  }
+
+  struct local_counters
+  {
+    counters* c;
+
+    local_counters()
+    {
+      registry& r = reg();
+      std::lock_guard<std::mutex> lock(r.m);
+
+      if(r.free.empty()) {
+	r.all.emplace_back(new counters());
+	c = r.all.back().get();
+      } else {
+	c = r.free.back();
+	r.free.pop_back();
+      }
+    }
+
+    ~local_counters()
+    {
+      registry& r = reg();
+      std::lock_guard<std::mutex> lock(r.m);
+
+      r.free.push_back(c);
+    }
+  };
+
+  inline static counters& local()
+  {
+    static thread_local local_counters lc;
+    return *lc.c;
+  }
+
+  // only the owning thread writes, so a plain add suffices.
+  inline static void bump(std::atomic<uint64_t>& c, uint64_t n)
+  {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static int64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static gc_totals sum(registry& r)
+  {
+    gc_totals s;
+    s.cycles = r.cycles;
+
+    for(size_t p = 0; p < num_gc_phases; ++p)
+      s.phase_ns[p] = r.phase_ns[p];
+
+    for(auto& cp : r.all) {
+      const counters& c = *cp;
+
+      s.polls += c.polls.load(std::memory_order_relaxed);
+      s.poll_wait_ns += c.poll_wait_ns.load(std::memory_order_relaxed);
+      s.log_ptrs_copied += c.log_ptrs_copied.load(std::memory_order_relaxed);
+      s.log_copies_elided += c.log_copies_elided.load(std::memory_order_relaxed);
+
+      for(size_t t = 0; t < num_ctrie_types; ++t) {
+	gc_type_stats& ts = s.types[t];
+
+	ts.objects_allocated += c.objects_allocated[t].load(std::memory_order_relaxed);
+	ts.bytes_allocated += c.bytes_allocated[t].load(std::memory_order_relaxed);
+	ts.objects_marked += c.objects_marked[t].load(std::memory_order_relaxed);
+	ts.bytes_marked += c.bytes_marked[t].load(std::memory_order_relaxed);
+	ts.objects_freed += c.objects_freed[t].load(std::memory_order_relaxed);
+	ts.bytes_freed += c.bytes_freed[t].load(std::memory_order_relaxed);
+      }
+    }
+
+    return s;
+  }
+
+  static gc_totals difference(const gc_totals& a, const gc_totals& b)
+  {
+    gc_totals d;
+    d.cycles = a.cycles - b.cycles;
+
+    for(size_t p = 0; p < num_gc_phases; ++p)
+      d.phase_ns[p] = a.phase_ns[p] - b.phase_ns[p];
+
+    d.polls = a.polls - b.polls;
+    d.poll_wait_ns = a.poll_wait_ns - b.poll_wait_ns;
+    d.log_ptrs_copied = a.log_ptrs_copied - b.log_ptrs_copied;
+    d.log_copies_elided = a.log_copies_elided - b.log_copies_elided;
+
+    for(size_t t = 0; t < num_ctrie_types; ++t) {
+      d.types[t].objects_allocated = a.types[t].objects_allocated - b.types[t].objects_allocated;
+      d.types[t].bytes_allocated = a.types[t].bytes_allocated - b.types[t].bytes_allocated;
+      d.types[t].objects_marked = a.types[t].objects_marked - b.types[t].objects_marked;
+      d.types[t].bytes_marked = a.types[t].bytes_marked - b.types[t].bytes_marked;
+      d.types[t].objects_freed = a.types[t].objects_freed - b.types[t].objects_freed;
+      d.types[t].bytes_freed = a.types[t].bytes_freed - b.types[t].bytes_freed;
+    }
+
+    return d;
+  }
+
+  // Ends the open phase at end_ns and starts p, or with p ==
+  // num_gc_phases, closes the cycle.
+  static void end_phase(registry& r, uint8_t p, int64_t end_ns)
+  {
+    uint8_t cur = r.phase.load(std::memory_order_relaxed);
+
+    if(end_ns > r.phase_start_ns)
+      r.phase_ns[cur] += end_ns - r.phase_start_ns;
+
+    if(p == num_gc_phases) {
+      ++r.cycles;
+
+      gc_totals now = sum(r);
+
+      r.last_cycle = difference(now, r.at_last_cycle);
+      r.at_last_cycle = now;
+    }
+
+    r.phase.store(p, std::memory_order_relaxed);
+  }
+
+  static void enter_phase(gc_phase p)
+  {
+    registry& r = reg();
+    std::lock_guard<std::mutex> lock(r.m);
+
+    uint8_t cur = r.phase.load(std::memory_order_relaxed);
+
+    if(cur < static_cast<uint8_t>(p)) {
+      int64_t now = now_ns();
+
+      end_phase(r, static_cast<uint8_t>(p), now);
+
+      r.phase_start_ns = now;
+      r.last_sample_ns.store(now, std::memory_order_relaxed);
+    }
+  }
+public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr const char* phase_names[num_gc_phases] = {
+    "handshake", "mark", "sweep"
+  };
+
+  // Mark and sweep read the clock once per phase_sample objects.
+  static constexpr unsigned phase_sample = 64;
+
+  static constexpr const char* type_names[num_ctrie_types] = {
+    "inode", "cnode", "snode", "tnode", "lnode", "failure",
+    "branch_vector", "string", "plist_node", "rdcss_descriptor", "misc"
+  };
+
+  inline static uint64_t since(clock::time_point start)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+  }
+
+  inline static void allocated(uint8_t tag, size_t bytes)
+  {
+    if(OTF_CTRIE_GC_STATS) {
+      counters& c = local();
+
+      bump(c.objects_allocated[tag], 1);
+      bump(c.bytes_allocated[tag], bytes);
+    }
+  }
+
+  inline static void marked(uint8_t tag, size_t bytes)
+  {
+    if(OTF_CTRIE_GC_STATS) {
+      counters& c = local();
+
+      bump(c.objects_marked[tag], 1);
+      bump(c.bytes_marked[tag], bytes);
+    }
+  }
+
+  inline static void freed(uint8_t tag, size_t bytes)
+  {
+    if(OTF_CTRIE_GC_STATS) {
+      counters& c = local();
+
+      bump(c.objects_freed[tag], 1);
+      bump(c.bytes_freed[tag], bytes);
+    }
+  }
+
+  inline static void log_ptr_copied()
+  {
+    if(OTF_CTRIE_GC_STATS)
+      bump(local().log_ptrs_copied, 1);
+  }
+
+  inline static void log_copy_elided()
+  {
+    if(OTF_CTRIE_GC_STATS)
+      bump(local().log_copies_elided, 1);
+  }
+
+  inline static void polled(uint64_t wait_ns)
+  {
+    if(OTF_CTRIE_GC_STATS) {
+      counters& c = local();
+
+      bump(c.polls, 1);
+      bump(c.poll_wait_ns, wait_ns);
+    }
+  }
+
+  // The collector's phases are seen through its calls into this tree:
+  // it takes the mutators' roots as a cycle's handshakes begin, traces
+  // objects to mark them and destroys them as it sweeps. A cycle opens
+  // with the first root callback after the last cycle's mark or sweep
+  // began, and that callback closes the last cycle. Returns whether it
+  // did.
+  //
+  // Handshake time runs up to the first object traced, and mark time to
+  // the first object freed. The cycle's last phase ends at its last
+  // clock sample, so it may miss up to phase_sample objects' work.
+  static bool roots_taken()
+  {
+    registry& r = reg();
+    std::lock_guard<std::mutex> lock(r.m);
+
+    uint8_t cur = r.phase.load(std::memory_order_relaxed);
+
+    if(cur == static_cast<uint8_t>(gc_phase::handshake))
+      return false;
+
+    int64_t now = now_ns();
+
+    if(cur != num_gc_phases)
+      end_phase(r, num_gc_phases, r.last_sample_ns.load(std::memory_order_relaxed));
+
+    r.phase.store(static_cast<uint8_t>(gc_phase::handshake), std::memory_order_relaxed);
+    r.opened.fetch_add(1, std::memory_order_release);
+    r.phase_start_ns = now;
+    r.last_sample_ns.store(now, std::memory_order_relaxed);
+
+    return cur != num_gc_phases;
+  }
+
+  // the cycles that have taken their roots so far, the current one
+  // included.
+  inline static uint64_t cycles_opened()
+  {
+    return reg().opened.load(std::memory_order_acquire);
+  }
+
+  // Called for each object marked or swept by the collector. Marks and
+  // frees outside a cycle, as by the benchmarks, only cost the test.
+  inline static void in_phase(gc_phase p)
+  {
+    registry& r = reg();
+    uint8_t cur = r.phase.load(std::memory_order_relaxed);
+
+    if(cur == static_cast<uint8_t>(p)) {
+      static thread_local unsigned calls = 0;
+
+      if(OTF_CTRIE_GC_STATS && ++calls % phase_sample == 0)
+	r.last_sample_ns.store(now_ns(), std::memory_order_relaxed);
+    } else if(cur < static_cast<uint8_t>(p)) {
+      enter_phase(p);
+    }
+  }
+
+  static gc_totals totals()
+  {
+    registry& r = reg();
+    std::lock_guard<std::mutex> lock(r.m);
+
+    return sum(r);
+  }
+
+  // The counts over the last complete cycle.
+  static gc_totals last_cycle()
+  {
+    registry& r = reg();
+    std::lock_guard<std::mutex> lock(r.m);
+
+    return r.last_cycle;
+  }
+
+  // cheaper than totals() for polling, as by gc_pacer.
+  static gc_heap_usage heap_usage()
+  {
+    registry& r = reg();
+    std::lock_guard<std::mutex> lock(r.m);
+
+    gc_heap_usage u;
+
+    for(auto& cp : r.all)
+      for(size_t t = 0; t < num_ctrie_types; ++t) {
+	u.allocated += cp->bytes_allocated[t].load(std::memory_order_relaxed);
+	u.freed += cp->bytes_freed[t].load(std::memory_order_relaxed);
+      }
+
+    return u;
+  }
+
+  static void write_prometheus(std::ostream& os, const gc_totals& s)
+  {
+    os << "# TYPE otf_gc_cycles_total counter\n"
+       << "otf_gc_cycles_total " << s.cycles << '\n';
+
+    os << "# TYPE otf_gc_phase_seconds_total counter\n";
+
+    for(size_t p = 0; p < num_gc_phases; ++p)
+      os << "otf_gc_phase_seconds_total{phase=\"" << phase_names[p] << "\"} "
+	 << s.phase_ns[p] / 1e9 << '\n';
+
+    os << "# TYPE otf_gc_polls_total counter\n"
+       << "otf_gc_polls_total " << s.polls << '\n'
+       << "# TYPE otf_gc_poll_wait_seconds_total counter\n"
+       << "otf_gc_poll_wait_seconds_total " << s.poll_wait_ns / 1e9 << '\n'
+       << "# TYPE otf_gc_log_ptrs_copied_total counter\n"
+       << "otf_gc_log_ptrs_copied_total " << s.log_ptrs_copied << '\n'
+       << "# TYPE otf_gc_log_copies_elided_total counter\n"
+       << "otf_gc_log_copies_elided_total " << s.log_copies_elided << '\n';
+
+    auto per_type = [&os, &s](const char* name, uint64_t gc_type_stats::* field) {
+      os << "# TYPE " << name << " counter\n";
+
+      for(size_t t = 0; t < num_ctrie_types; ++t)
+	os << name << "{type=\"" << type_names[t] << "\"} " << s.types[t].*field << '\n';
+    };
+
+    per_type("otf_gc_objects_allocated_total", &gc_type_stats::objects_allocated);
+    per_type("otf_gc_bytes_allocated_total", &gc_type_stats::bytes_allocated);
+    per_type("otf_gc_objects_marked_total", &gc_type_stats::objects_marked);
+    per_type("otf_gc_bytes_marked_total", &gc_type_stats::bytes_marked);
+    per_type("otf_gc_objects_freed_total", &gc_type_stats::objects_freed);
+    per_type("otf_gc_bytes_freed_total", &gc_type_stats::bytes_freed);
+  }
+
+  // Writes the totals to path in the Prometheus text format, through a
+  // rename so a scraper never reads a partial file.
+  static bool dump_prometheus(const std::string& path)
+  {
+    std::string tmp = path + ".tmp";
+
+    {
+      std::ofstream out(tmp);
+
+      if(!out)
+	return false;
+
+      write_prometheus(out, totals());
+
+      if(!out.flush())
+	return false;
+    }
+
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+};
+#endif
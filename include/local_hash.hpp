@@ -0,0 +1,110 @@
+#ifndef LOCAL_HASH_HPP_INCLUDED
+#define LOCAL_HASH_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace hash_impl
+{
+  static const uint64_t k0 = 0xa0761d6478bd642full;
+  static const uint64_t k1 = 0xe7037ed1a0b428dbull;
+  static const uint64_t k2 = 0x8ebc6af09c88c6e3ull;
+  static const uint64_t k3 = 0x589965cc75374cc3ull;
+
+  inline uint64_t load_word(const char* p)
+  {
+    uint64_t w;
+    std::memcpy(&w, p, sizeof(w));
+    return w;
+  }
+
+  // folds two words into one through a 64x64->128 bit multiply.
+  inline uint64_t mum(uint64_t a, uint64_t b)
+  {
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+  }
+
+  // the murmur3 finalizer, so every input bit reaches every output bit.
+  inline uint64_t fmix64(uint64_t h)
+  {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h;
+  }
+}
+
+// Hashes n bytes a word at a time. Keys of 32 bytes or more are consumed
+// by two independent lanes so the multiplies overlap.
+inline size_t hash_bytes(const char* p, size_t n)
+{
+  using namespace hash_impl;
+
+  uint64_t h1 = k0 ^ (n * k1);
+
+  if(n >= 32) {
+    uint64_t h2 = h1 ^ k2;
+
+    do {
+      h1 = mum(load_word(p) ^ k1, load_word(p + 8) ^ h1);
+      h2 = mum(load_word(p + 16) ^ k2, load_word(p + 24) ^ h2);
+
+      p += 32;
+      n -= 32;
+    } while(n >= 32);
+
+    h1 ^= h2;
+  }
+
+  if(n >= 16) {
+    h1 = mum(load_word(p) ^ k1, load_word(p + 8) ^ h1);
+
+    p += 16;
+    n -= 16;
+  }
+
+  if(n >= 8) {
+    h1 = mum(load_word(p) ^ k2, h1 ^ k3);
+
+    p += 8;
+    n -= 8;
+  }
+
+  if(n > 0) {
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, n);
+
+    h1 = mum(tail ^ k3, h1 ^ k0);
+  }
+
+  return fmix64(h1);
+}
+
+template <typename T>
+struct local_hash
+{
+  using result_type = size_t;
+
+  size_t operator()(const T& s) const
+  {
+    if constexpr(std::is_integral<T>::value && sizeof(T) <= sizeof(uint64_t)) {
+      return hash_impl::fmix64(static_cast<uint64_t>(s) ^ hash_impl::k0);
+    } else if constexpr(std::is_trivially_copyable<T>::value) {
+      // fixed size keys are hashed by their object representation, which
+      // is only determined by their value if they have no padding.
+      static_assert(std::has_unique_object_representations_v<T>,
+		    "keys with padding bits must be given their own Hash.");
+
+      return hash_bytes(reinterpret_cast<const char*>(&s), sizeof(T));
+    } else {
+      return s.hash();
+    }
+  }
+};
+#endif
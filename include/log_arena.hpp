@@ -0,0 +1,151 @@
+#ifndef LOG_ARENA_HPP_INCLUDED
+#define LOG_ARENA_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+// Bump allocation for the copies copy_obj makes for the write barrier's
+// logs. A copy is read by the mark of the cycle open when it was made,
+// or, if it was made in the handshakes before a cycle takes its roots,
+// by that cycle's. Each thread bump allocates copies from chunks stamped
+// with the arena's cycle, and cycle_ended, called as each cycle takes its
+// roots, frees every chunk from before the last call at once.
+class log_arena
+{
+private:
+  static constexpr size_t chunk_size = 1 << 16;
+  static constexpr size_t align = alignof(std::max_align_t);
+
+  struct chunk
+  {
+    chunk* next;
+  };
+
+  static constexpr size_t chunk_header = (sizeof(chunk) + align - 1) & ~(align - 1);
+
+  // the thread's current chunk, by its bounds only: chunks of a past
+  // cycle, or of an arena since destroyed, may already be freed.
+  struct local_chunk
+  {
+    uint64_t arena = 0;
+    uint64_t cycle = 0;
+    char* bump = nullptr;
+    char* end = nullptr;
+  };
+
+  // ids aren't reused, unlike addresses, so a thread's chunk is never
+  // mistaken for one of a later arena.
+  static uint64_t next_id()
+  {
+    static std::atomic<uint64_t> ids { 0 };
+    return ids.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  const uint64_t id = next_id();
+
+  std::mutex m;
+  // the chunks made since the last cycle_ended, and those made before.
+  chunk* chunks = nullptr;
+  chunk* retired = nullptr;
+  std::atomic<uint64_t> cycle { 0 };
+
+  static void free_chunks(chunk* c)
+  {
+    while(c) {
+      chunk* next = c->next;
+      std::free(c);
+      c = next;
+    }
+  }
+
+  inline static local_chunk& local()
+  {
+    static thread_local local_chunk lc;
+    return lc;
+  }
+
+  void* refill(local_chunk& lc, uint64_t cyc, size_t n)
+  {
+    size_t sz = std::max(chunk_size, chunk_header + n);
+
+    chunk* c = reinterpret_cast<chunk*>(std::aligned_alloc(align, (sz + align - 1) & ~(align - 1)));
+
+    if(!c)
+      return nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(m);
+
+      c->next = chunks;
+      chunks = c;
+    }
+
+    lc.arena = id;
+    lc.cycle = cyc;
+    lc.bump = reinterpret_cast<char*>(c) + chunk_header + n;
+    lc.end = reinterpret_cast<char*>(c) + sz;
+
+    return reinterpret_cast<char*>(c) + chunk_header;
+  }
+public:
+  log_arena() = default;
+
+  log_arena(const log_arena&) = delete;
+  log_arena& operator=(const log_arena&) = delete;
+
+  ~log_arena()
+  {
+    free_chunks(chunks);
+    free_chunks(retired);
+  }
+
+  // The arena copy_obj allocates from.
+  static log_arena& copies()
+  {
+    static log_arena a;
+    return a;
+  }
+
+  // n bytes, aligned for any object, that live until the second
+  // cycle_ended from now.
+  inline void* allocate(size_t n)
+  {
+    local_chunk& lc = local();
+
+    n = (n + align - 1) & ~(align - 1);
+    uint64_t cyc = cycle.load(std::memory_order_acquire);
+
+    if(lc.arena == id && lc.cycle == cyc && lc.bump + n <= lc.end) {
+      void* p = lc.bump;
+      lc.bump += n;
+
+      return p;
+    }
+
+    return refill(lc, cyc, n);
+  }
+
+  // Frees the copies made before the last call. Those made since may
+  // still be marked from by the cycle now taking its roots, and are kept
+  // for the next call.
+  void cycle_ended()
+  {
+    chunk* freed;
+
+    {
+      std::lock_guard<std::mutex> lock(m);
+
+      freed = retired;
+      retired = chunks;
+      chunks = nullptr;
+      cycle.fetch_add(1, std::memory_order_release);
+    }
+
+    free_chunks(freed);
+  }
+};
+#endif
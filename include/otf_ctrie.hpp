@@ -4,13 +4,25 @@
 #include <algorithm>
 #include <atomic>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "atomic_list.hpp"
 #include "ctrie.hpp"
+#include "ctrie_bits.hpp"
 #include "ctrie_type_tags.hpp"
+#include "gc_pacer.hpp"
+#include "gc_stats.hpp"
 #include "impl_details.hpp"
+#include "local_hash.hpp"
+#include "log_arena.hpp"
 #include "mutator.hpp"
 #include "gc.hpp"
 #include "ref_string.hpp"
@@ -19,32 +31,255 @@
 using namespace kl_ctrie;
 using namespace otf_gc;
 
-template <typename T>
-struct local_hash
+template <typename K, typename V, class Hash = local_hash<K>>
+class basic_otf_ctrie_tracer;
+
+template <typename K, typename V, class Hash = local_hash<K>>
+class basic_otf_ctrie_view;
+
+inline std::unique_ptr<typename gc::registered_mutator>& mt()
 {
-  using result_type = size_t;
+  static thread_local std::unique_ptr<gc::registered_mutator> mt =
+    gc::create_mutator();
+  return mt;
+}
+
+// Run by the root callback that closes a cycle (see
+// gc_stats::roots_taken). That cycle has marked, so the log copies made
+// before it took its roots are no longer read.
+inline void cycle_ended()
+{
+  log_arena::copies().cycle_ended();
+}
+
+// The roots of the ctries and snapshots made on a thread, as a compact
+// array of slots. The registry installs its mutator's one root callback,
+// which walks the slots; each slot is added and removed by a scoped_root
+// owned by the ctrie, so however many ctries share a mutator, each is
+// scanned while it lives and costs nothing once it's gone.
+//
+// A ctrie may be destroyed on a thread other than the one that made it,
+// so the slots are locked; the lock is uncontended otherwise.
+class root_registry
+{
+private:
+  struct slot
+  {
+    const void* obj;
+    void* (*root)(const void*);
+    // where the owning scoped_root keeps this slot's index, rewritten
+    // when a removal moves the slot.
+    size_t* index;
+  };
 
-  static void hash_combine(size_t& seed, char c) {
-    seed ^= c + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  std::mutex m;
+  std::vector<slot> slots;
+
+  root_registry() = default;
+
+  static std::shared_ptr<root_registry> install()
+  {
+    std::shared_ptr<root_registry> r(new root_registry());
+
+    mt()->set_root_callback([r]() {
+	if(gc_stats::roots_taken())
+	  cycle_ended();
+
+	return r->ct_callback();
+      });
+
+    return r;
   }
+public:
+  root_registry(const root_registry&) = delete;
+  root_registry& operator=(const root_registry&) = delete;
 
-  size_t operator()(const T& s) const
+  // The calling thread's registry, made on first use. Setting the
+  // mutator's root callback by hand afterwards replaces the registry's.
+  static const std::shared_ptr<root_registry>& local()
   {
-    size_t hash = 0;
-    for(auto it = s.cbegin(), end = s.cend(); it != end; ++it)
-      hash_combine(hash, *it);
-    return hash;
+    static thread_local std::shared_ptr<root_registry> r = install();
+    return r;
+  }
+
+  // Adds the root root(obj), storing its slot's index in *index.
+  void add(const void* obj, void* (*root)(const void*), size_t* index)
+  {
+    std::lock_guard<std::mutex> lock(m);
+
+    *index = slots.size();
+    slots.push_back(slot { obj, root, index });
+  }
+
+  // Removes the slot at *index, moving the last slot into its place.
+  void remove(size_t* index)
+  {
+    std::lock_guard<std::mutex> lock(m);
+
+    size_t i = *index;
+
+    if(i + 1 < slots.size()) {
+      slots[i] = slots.back();
+      *slots[i].index = i;
+    }
+
+    slots.pop_back();
+  }
+
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(m);
+    return slots.size();
+  }
+
+  list<void*> ct_callback()
+  {
+    std::lock_guard<std::mutex> lock(m);
+    list<void*> l;
+
+    for(const slot& s : slots)
+      l.push_front(s.root(s.obj));
+
+    return l;
   }
 };
 
-class otf_ctrie_policy;
-class otf_ctrie_tracer;
+// Registers a root with the registry of the thread making it, for as
+// long as the scoped_root lives. It can't be copied or moved, since its
+// slot refers to it; an owner that is copied makes a fresh one.
+class scoped_root
+{
+private:
+  std::shared_ptr<root_registry> registry;
+  size_t index;
 
-inline std::unique_ptr<typename gc::registered_mutator>& mt()
+  template <class Ctrie>
+  static void* root_of(const void* ct)
+  {
+    return const_cast<Ctrie*>(static_cast<const Ctrie*>(ct))->root_ptr();
+  }
+public:
+  scoped_root(const void* obj, void* (*root)(const void*))
+    : registry(root_registry::local())
+  {
+    registry->add(obj, root, &index);
+  }
+
+  // The root of ct, read by its root_ptr() at each scan.
+  template <class Ctrie>
+  explicit scoped_root(Ctrie& ct)
+    : scoped_root(&ct, &root_of<Ctrie>)
+  {}
+
+  scoped_root(const scoped_root&) = delete;
+  scoped_root& operator=(const scoped_root&) = delete;
+
+  ~scoped_root()
+  {
+    registry->remove(&index);
+  }
+};
+
+// The barriered objects this thread allocated since the current cycle
+// took its roots, at the allocation color it had then. None of them can
+// be in the snapshot the collector is tracing, so stores into them need
+// no log copy, and log_ptr hands the barrier a slot already logged
+// instead of theirs. The ring is stamped with the cycle and color it was
+// filled in, and reads as empty once either moves on, so it is right
+// however the thread answers handshakes. Only the last few objects are
+// kept: the stores that matter are the initializing ones made right
+// after allocation, as when insert builds a cnode copy.
+class fresh_objects
 {
-  static thread_local std::unique_ptr<gc::registered_mutator> mt =
-    gc::create_mutator();
-  return mt;
+private:
+  static const size_t capacity = 8;
+
+  struct ring
+  {
+    const void* objs[capacity] = {};
+    size_t next = 0;
+    uint64_t cycle = 0;
+    uint8_t color = 0;
+  };
+
+  inline static ring& local()
+  {
+    static thread_local ring r;
+    return r;
+  }
+
+  inline static uint8_t mut_color()
+  {
+    return static_cast<uint8_t>(mt()->mut_color().c);
+  }
+public:
+  inline static void allocated(const void* p)
+  {
+    ring& r = local();
+    uint8_t c = mut_color();
+    uint64_t cycle = gc_stats::cycles_opened();
+
+    if(c != r.color || cycle != r.cycle) {
+      r = ring();
+      r.color = c;
+      r.cycle = cycle;
+    }
+
+    r.objs[r.next++ % capacity] = p;
+  }
+
+  inline static bool contains(const void* p)
+  {
+    ring& r = local();
+
+    if(r.next == 0)
+      return false;
+
+    for(const void* obj : r.objs)
+      if(obj == p)
+	return r.color == mut_color() && r.cycle == gc_stats::cycles_opened();
+
+    return false;
+  }
+
+  // Forgets every object, as after a test or benchmark marks objects
+  // fresh by hand.
+  inline static void clear()
+  {
+    local() = ring();
+  }
+
+  // A log pointer slot that always reads as logged. The barrier only
+  // tests a slot against null, so the copy it points to is never read.
+  inline static impl_details::log_ptr_t* logged_slot()
+  {
+    static impl_details::log_ptr_t slot { &slot };
+    return &slot;
+  }
+};
+
+// answers a pending handshake, counting the wait in gc_stats. Over the
+// gc_pacer's soft limit, it then waits a while on the collector.
+inline void poll_for_sync()
+{
+#if OTF_CTRIE_GC_STATS
+  auto start = gc_stats::clock::now();
+#endif
+
+  mt()->poll_for_sync();
+
+#if OTF_CTRIE_GC_STATS
+  gc_stats::polled(gc_stats::since(start));
+#endif
+
+  gc_pacer::throttle([]() { mt()->poll_for_sync(); });
+}
+
+// Runs a full collection cycle, answering handshakes until it ends.
+inline void collect()
+{
+  gc_pacer::collect([]() { poll_for_sync(); },
+		    []() { return mt()->mut_color().c; });
 }
 
 class string_allocator
@@ -64,8 +299,12 @@ class string_allocator
     header_t* hp = reinterpret_cast<header_t*>(data - header_size);
     auto h = hp->load(std::memory_order_relaxed);
 
-    h = ((h >> color_bits) << color_bits) | static_cast<underlying_header_t>(mt()->mut_color().c);
-    hp->store(h, std::memory_order_relaxed);
+    auto nh = ((h >> color_bits) << color_bits) | static_cast<underlying_header_t>(mt()->mut_color().c);
+
+    // hot keys are copied from many threads at once, and storing the
+    // color they already have would bounce the header's line between them.
+    if(nh != h)
+      hp->store(nh, std::memory_order_relaxed);
 
     return data;
   }
@@ -79,13 +318,26 @@ class string_allocator
     
     void* ptr = mt()->allocate(n * sizeof(value_type), h, 0);
 
+    gc_stats::allocated(static_cast<uint8_t>(ctrie_internal_types::SV_t),
+			header_size + n * sizeof(value_type));
+
     return reinterpret_cast<value_type*>(ptr);
   }
 
   void deallocate(value_type*, size_t) {}
 };
 
-using ctrie_string = ref_string<string_allocator>;
+// Keys of up to this many characters are stored inside their snode, and
+// only longer ones in a separate string object. 0 stores every key apart.
+#ifndef OTF_CTRIE_INLINE_KEY_LEN
+#define OTF_CTRIE_INLINE_KEY_LEN 15
+#endif
+
+using ctrie_string = ref_string<string_allocator, false, OTF_CTRIE_INLINE_KEY_LEN>;
+
+// keeps its hash alongside the characters, so operations repeated on the
+// same key (or its copies) hash it only once.
+using hashed_ctrie_string = ref_string<string_allocator, true>;
 
 template <typename T>
 class otf_ctrie_allocator
@@ -104,20 +356,69 @@ public:
 			       static_cast<impl_details::underlying_header_t>(ctrie_type_info<T>::header_value),
 			       ctrie_type_info<T>::num_log_ptrs);
 
+    if(ctrie_type_info<T>::num_log_ptrs > 0)
+      fresh_objects::allocated(ptr);
+
+    gc_stats::allocated(static_cast<uint8_t>(ctrie_type_info<T>::header_value),
+			impl_details::header_size
+			+ ctrie_type_info<T>::num_log_ptrs * impl_details::log_ptr_size
+			+ n * sizeof(T));
+
     return reinterpret_cast<T*>(ptr);
   }
 
   inline void deallocate(T*, size_t) {}
 };
 
-template <typename T>
-using otf_ctrie_write_barrier = otf_write_barrier<mt, otf_ctrie_tracer, T>;
+// The node types of the ctrie managed by one collector, each behind a
+// write barrier that copies through basic_otf_ctrie_tracer<K, V, Hash>.
+template <typename K, typename V, class Hash>
+struct otf_ctrie_types
+{
+  template <typename T>
+  using write_barrier = otf_write_barrier<mt, basic_otf_ctrie_tracer<K, V, Hash>, T>;
 
-template <typename T>
-class branch_vector_allocator<otf_ctrie_write_barrier<T>>
+  using ctrie_type = ctrie<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+
+  using inode_type = inode<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using cnode_type = cnode<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using snode_type = snode<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using tnode_type = tnode<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using lnode_type = lnode<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using failure_type = failure<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using branch_type = branch<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using rdcss_desc = rdcss_descriptor<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+  using root_type = inode_or_rdcss<K, V, Hash, otf_ctrie_allocator, write_barrier>*;
+
+  using node_types = ctrie_node_types<K, V, Hash, otf_ctrie_allocator, write_barrier>;
+
+  // the hash bits each of kl_ctrie's cnodes branches on, one per bit of
+  // its 32-bit bitmap. The walkers check the bitmap's width against it.
+  static const unsigned level_bits = 5;
+
+  using bits = ctrie_bits<level_bits>;
+};
+
+// Barrier is an alias template here, so the generic BV_t specialization
+// in ctrie_type_tags.hpp can't deduce through it.
+template <class Tracer,
+	  typename K,
+	  typename V,
+	  class Hash,
+	  template <class> class Alloc,
+	  template <class> class Barrier>
+struct ctrie_type_info<otf_write_barrier<mt, Tracer, branch<K, V, Hash, Alloc, Barrier>*>>
+{
+  static const ctrie_internal_types header_value = ctrie_internal_types::BV_t;
+  static const size_t num_log_ptrs = 0;
+  static const bool variable_size = true;
+};
+
+template <class Tracer, typename T>
+class branch_vector_allocator<otf_write_barrier<mt, Tracer, T>>
 {
  public:
-  using value_type = otf_ctrie_write_barrier<T>;
+  using value_type = otf_write_barrier<mt, Tracer, T>;
 
   branch_vector_allocator() = default;
 
@@ -129,310 +430,327 @@ class branch_vector_allocator<otf_ctrie_write_barrier<T>>
       (sz << tag_bits) | static_cast<underlying_header_t>(ctrie_internal_types::BV_t);
     void* ptr = mt()->allocate(sz * sizeof(value_type), h, 0);
 
+    gc_stats::allocated(static_cast<uint8_t>(ctrie_internal_types::BV_t),
+			header_size + sz * sizeof(value_type));
+
     return reinterpret_cast<value_type*>(ptr);
   }
 
   void deallocate(value_type*, size_t) {}
 };
 
-class otf_ctrie_policy
+// How the tracer reaches into snode keys and values. Trivially copyable
+// types are stored inline in the snode and hold no managed pointers.
+template <typename T>
+struct otf_ctrie_field
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+		"otf_ctrie keys and values must be trivially copyable or specialize otf_ctrie_field.");
+
+  template <typename F>
+  inline static void trace(const T&, F&)
+  {}
+};
+
+// Inline strings are part of their snode and hold nothing to trace.
+template <bool CacheHash, size_t InlineLen>
+struct otf_ctrie_field<ref_string<string_allocator, CacheHash, InlineLen>>
+{
+  template <typename F>
+  inline static void trace(const ref_string<string_allocator, CacheHash, InlineLen>& s, F& visit)
+  {
+    if(!s.inlined() && s.data())
+      visit(reinterpret_cast<void*>(const_cast<char*>(s.data())));
+  }
+};
+
+template <typename K, typename V, class Hash = local_hash<K>>
+class basic_otf_ctrie_policy
 {
 private:
   template <typename T>
-  static void destroy_type(void* ptr)
+  inline static void destroy_type(ctrie_type_tag<T>, void* ptr)
   {
-    T* t_ptr = reinterpret_cast<T*>(ptr);
-    t_ptr->~T();
+    // vectors hold nothing needing destruction.
+    if(!ctrie_type_info<T>::variable_size) {
+      T* t_ptr = reinterpret_cast<T*>(ptr);
+      t_ptr->~T();
+    }
   }
-
-  static void destroy_vector(void*)
-  {}
-    
-  static const std::function<void(void*)> destructor_table[];  
-public:    
+public:
   using roots_type = void*;
-    
-  using mutator_type = kl_ctrie::ctrie<ctrie_string,
-				       int,
-				       local_hash<ctrie_string>,
-				       otf_ctrie_allocator,
-				       otf_ctrie_write_barrier>;
+
+  using mutator_type = typename otf_ctrie_types<K, V, Hash>::ctrie_type;
 
   inline static void destroy(impl_details::underlying_header_t h, impl_details::header_t* ptr)
   {
     using namespace impl_details;
-      
-    std::ptrdiff_t d = reinterpret_cast<std::ptrdiff_t>(ptr) + header_size;
-    destructor_table[(h & header_tag_mask) >> color_bits](reinterpret_cast<void*>(d));
-  }    
+    using node_types = typename otf_ctrie_types<K, V, Hash>::node_types;
+
+    void* d = reinterpret_cast<void*>(reinterpret_cast<std::ptrdiff_t>(ptr) + header_size);
+
+    gc_stats::in_phase(gc_phase::sweep);
+    gc_stats::freed((h & header_tag_mask) >> color_bits,
+		    basic_otf_ctrie_tracer<K, V, Hash>::object_bytes(h));
+
+    node_types::dispatch((h & header_tag_mask) >> color_bits, [d](auto tag) {
+	destroy_type(tag, d);
+      });
+  }
+};
+
+// A non-owning reference to a callable taking derived pointers. Tracers
+// hand each child pointer to it directly, so marking an object builds no
+// intermediate list. visit_derived_ptrs takes any callable, and inlines
+// it; this is for callers that need one type for every visitor, such as
+// a mark loop compiled apart from the tracer.
+class derived_ptr_visitor
+{
+private:
+  void* ctx;
+  void (*visit_fn)(void*, void*);
+public:
+  template <typename F,
+	    typename = std::enable_if_t<!std::is_same<std::decay_t<F>, derived_ptr_visitor>::value>>
+  derived_ptr_visitor(F& f)
+    : ctx(reinterpret_cast<void*>(&f)),
+      visit_fn([](void* c, void* p) { (*reinterpret_cast<F*>(c))(p); })
+  {}
+
+  inline void operator()(void* p) const
+  {
+    visit_fn(ctx, p);
+  }
 };
 
-class otf_ctrie_tracer
+// The collector is run with the tracer and policy of the one ctrie
+// instantiation whose nodes it manages.
+template <typename K, typename V, class Hash>
+class basic_otf_ctrie_tracer
 {
 private:
-  static list<void*> trace_inode(void* ptr)
+  using types = otf_ctrie_types<K, V, Hash>;
+
+  using inode_type = typename types::inode_type;
+  using cnode_type = typename types::cnode_type;
+  using snode_type = typename types::snode_type;
+  using tnode_type = typename types::tnode_type;
+  using lnode_type = typename types::lnode_type;
+  using failure_type = typename types::failure_type;
+  using branch_type = typename types::branch_type;
+  using rdcss_desc = typename types::rdcss_desc;
+public:
+  using node_types = typename types::node_types;
+
+  template <typename F>
+  inline static void trace(ctrie_type_tag<inode_type>, void* ptr, F& visit)
   {
-    auto& in = *reinterpret_cast<inode<ctrie_string,
-				       int,
-				       local_hash<ctrie_string>,
-				       otf_ctrie_allocator,
-				       otf_ctrie_write_barrier>*>(ptr);
+    auto& in = *reinterpret_cast<inode_type*>(ptr);
 
     auto mn = in.main.load(std::memory_order_relaxed);
 
-    if(mn) {
-      return { mn->derived_ptr() };
-    } else
-      return {};
+    if(mn)
+      visit(mn->derived_ptr());
   }
 
-  static list<void*> trace_cnode(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<cnode_type>, void* ptr, F& visit)
   {
-    using namespace impl_details;
-
-    auto cn = reinterpret_cast<cnode<ctrie_string,
-				     int,
-				     local_hash<ctrie_string>,
-				     otf_ctrie_allocator,
-				     otf_ctrie_write_barrier>*>(ptr);
-
-    list<void*> result;
+    auto cn = reinterpret_cast<cnode_type*>(ptr);
 
     if(auto cpn = cn->prev.load(std::memory_order_relaxed))
-      result.push_front(cpn->derived_ptr());
+      visit(cpn->derived_ptr());
 
     if(cn->arr.data())
-      result.push_front(reinterpret_cast<void*>(cn->arr.data()));
+      visit(reinterpret_cast<void*>(cn->arr.data()));
 
     for(auto& p : cn->arr)
       if(p.get())
-	result.push_front(reinterpret_cast<void*>(p->derived_ptr()));
-
-    return result;
+	visit(reinterpret_cast<void*>(p->derived_ptr()));
   }
 
-  static list<void*> trace_snode(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<snode_type>, void* ptr, F& visit)
   {
-    auto& sn = *reinterpret_cast<snode<ctrie_string,
-				       int,
-				       local_hash<ctrie_string>,
-				       otf_ctrie_allocator,
-				       otf_ctrie_write_barrier>*>(ptr);
+    auto& sn = *reinterpret_cast<snode_type*>(ptr);
 
-    if(sn.k.data())
-      return { reinterpret_cast<void*>(const_cast<char*>(sn.k.data())) };
-    else
-      return {};
+    otf_ctrie_field<K>::trace(sn.k, visit);
+    otf_ctrie_field<V>::trace(sn.v, visit);
   }
 
-  static list<void*> trace_tnode(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<tnode_type>, void* ptr, F& visit)
   {
-    auto& tn = *reinterpret_cast<tnode<ctrie_string,
-				       int,
-				       local_hash<ctrie_string>,
-				       otf_ctrie_allocator,
-				       otf_ctrie_write_barrier>*>(ptr);
-
-    list<void*> result;
+    auto& tn = *reinterpret_cast<tnode_type*>(ptr);
 
     if(auto tpn = tn.prev.load(std::memory_order_relaxed))
-      result.push_front(tpn->derived_ptr());
+      visit(tpn->derived_ptr());
 
     if(tn.sn)
-      result.push_front(const_cast<void*>(reinterpret_cast<const void*>(tn.sn)));
-
-    return result;
+      visit(const_cast<void*>(reinterpret_cast<const void*>(tn.sn)));
   }
 
-  static list<void*> trace_lnode(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<lnode_type>, void* ptr, F& visit)
   {
-    using internal_pl_type = kl_ctrie::snode<ctrie_string,
-					     int,
-					     local_hash<ctrie_string>,
-					     otf_ctrie_allocator,
-					     otf_ctrie_write_barrier>*;
+    using pl_type = plist_node<snode_type*>;
 
-    using pl_type = plist_node<internal_pl_type>;
-
-    auto& ln = *reinterpret_cast<lnode<ctrie_string,
-				       int,
-				       local_hash<ctrie_string>,
-				       otf_ctrie_allocator,
-				       otf_ctrie_write_barrier>*>(ptr);
+    auto& ln = *reinterpret_cast<lnode_type*>(ptr);
 
     const auto& n = *reinterpret_cast<const std::atomic<pl_type*>*>(&ln.contents);
     const void* v = reinterpret_cast<const void*>(n.load(std::memory_order_relaxed));
 
-    list<void*> result;
-
     if(auto lpn = ln.prev.load(std::memory_order_relaxed))
-      result.push_front(lpn->derived_ptr());
+      visit(lpn->derived_ptr());
 
     if(v)
-      result.push_front(const_cast<void*>(v));
-
-    return result;
+      visit(const_cast<void*>(v));
   }
 
-  static list<void*> trace_failure(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<failure_type>, void* ptr, F& visit)
   {
-    auto& fn = *reinterpret_cast<failure<ctrie_string,
-					 int,
-					 local_hash<ctrie_string>,
-					 otf_ctrie_allocator,
-					 otf_ctrie_write_barrier>*>(ptr);
+    auto& fn = *reinterpret_cast<failure_type*>(ptr);
 
     if(fn.prev.get())
-      return { fn.prev->derived_ptr() };
-    else
-      return {};
+      visit(fn.prev->derived_ptr());
   }
 
-  static list<void*> trace_branch_vector(void*)
-  {
-    return {};
-  }
+  template <typename F>
+  inline static void trace(ctrie_type_tag<typename types::template write_barrier<branch_type*>>, void*, F&)
+  {}
 
-  static list<void*> trace_string(void*)
-  {
-    return {};
-  }
+  template <typename F>
+  inline static void trace(ctrie_type_tag<char>, void*, F&)
+  {}
 
-  static list<void*> trace_plist_node(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<plist_node<snode_type>>, void* ptr, F& visit)
   {
-    using internal_pl_type = kl_ctrie::snode<ctrie_string,
-					     int,
-					     local_hash<ctrie_string>,
-					     otf_ctrie_allocator,
-					     otf_ctrie_write_barrier>*;
-
+    using internal_pl_type = snode_type*;
     using pl_type = const plist_node<internal_pl_type>;
 
     const auto& n  = *reinterpret_cast<pl_type*>(ptr);
     const auto& nd = static_cast<const internal_pl_type&>(n.data);
 
-    list<void*> result;
-
     if(n.next)
-      result.push_front(reinterpret_cast<void*>(n.next));
+      visit(reinterpret_cast<void*>(n.next));
 
     if(nd)
-      result.push_front(const_cast<void*>(reinterpret_cast<const void*>(nd)));
-
-    return result;
+      visit(const_cast<void*>(reinterpret_cast<const void*>(nd)));
   }
 
-  static list<void*> trace_rdcss_desc(void* ptr)
+  template <typename F>
+  inline static void trace(ctrie_type_tag<rdcss_desc>, void* ptr, F& visit)
   {
-    using rdcss_desc = rdcss_descriptor<ctrie_string,
-					int,
-					local_hash<ctrie_string>,
-					otf_ctrie_allocator,
-					otf_ctrie_write_barrier>;
-
-    list<void*> result;
-
     auto rd_ptr = reinterpret_cast<rdcss_desc*>(ptr);
 
     if(rd_ptr->ov.get())
-      result.push_front(rd_ptr->ov.get()->derived_ptr());
+      visit(rd_ptr->ov.get()->derived_ptr());
 
     if(rd_ptr->expected_main.get())
-      result.push_front(rd_ptr->expected_main.get()->derived_ptr());
+      visit(rd_ptr->expected_main.get()->derived_ptr());
 
     if(rd_ptr->nv.get())
-      result.push_front(rd_ptr->nv.get()->derived_ptr());
+      visit(rd_ptr->nv.get()->derived_ptr());
+  }
 
-    return result;
+  inline static size_t num_log_ptrs(impl_details::underlying_header_t h)
+  {
+    using namespace impl_details;
+    return node_types::num_log_ptrs[(h & header_tag_mask) >> color_bits];
   }
 
-  static list<void*> trace_nothing(void*)
+  inline static size_t size_of(impl_details::underlying_header_t h)
   {
-    return {};
+    using namespace impl_details;
+    return node_types::sizes[(h & header_tag_mask) >> color_bits];
   }
 
-  static const std::function<list<void*>(void*)> tracer_table[];
-public:
-  static size_t num_log_ptrs(impl_details::underlying_header_t h)
+  // The bytes of the object with header h, without its header and log
+  // pointers.
+  inline static size_t payload_bytes(impl_details::underlying_header_t h)
   {
     using namespace impl_details;
 
-    static const size_t log_ptr_num_table[] = {
-      1, //Inode
-      1, //Cnode
-      0, //Snode
-      0, //Tnode
-      0, //Lnode
-      1, //Failure
-      0, //branch
-      0, //plist_node<snode>
-      0, //char
-      1 //rdcss_descriptor
-    };
+    auto type_tag = (h & header_tag_mask) >> color_bits;
+    size_t n = h >> (color_bits + tag_bits);
 
-    return log_ptr_num_table[(h & header_tag_mask) >> color_bits];
+    if(type_tag == static_cast<uint8_t>(ctrie_internal_types::BV_t))
+      return n * sizeof(branch_type*);
+    else if(type_tag == static_cast<uint8_t>(ctrie_internal_types::SV_t))
+      return n;
+
+    return size_of(h);
   }
 
-  static size_t size_of(impl_details::underlying_header_t h)
+  // The heap footprint of the object with header h, counting its header
+  // and log pointers.
+  inline static size_t object_bytes(impl_details::underlying_header_t h)
   {
     using namespace impl_details;
-    using namespace kl_ctrie;
-
-    static const size_t sizes_table[] = {
-      sizeof(inode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //Inode
-      sizeof(cnode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //Cnode
-      sizeof(snode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //Snode
-      sizeof(tnode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //Tnode
-      sizeof(lnode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //Lnode
-      sizeof(failure<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //Failure
-      0,
-      0,
-      sizeof(plist_node<snode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>), //plist_node<snode>
-      sizeof(rdcss_descriptor<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>), //rdcss_descriptor
-    };
-
-    return sizes_table[(h & header_tag_mask) >> color_bits];
+    return header_size + num_log_ptrs(h) * log_ptr_size + payload_bytes(h);
   }
 
-  static list<void*> get_derived_ptrs(impl_details::underlying_header_t h, void* root)
+  // Calls f on each derived pointer held by root. The collector's mark
+  // loop should prefer visit_derived_ptrs_of_obj_segment to
+  // get_derived_ptrs, pushing straight onto its mark stack. Walks that
+  // aren't the collector's mark call this directly, so it counts nothing
+  // in gc_stats; the collector's entry points below count each object
+  // they trace as marked.
+  template <typename F>
+  inline static void visit_derived_ptrs(impl_details::underlying_header_t h, void* root, F&& f)
   {
     using namespace impl_details;
-    std::ptrdiff_t d = reinterpret_cast<std::ptrdiff_t>(root);
-    return tracer_table[(h & header_tag_mask) >> color_bits](reinterpret_cast<void*>(d));
+
+    node_types::dispatch((h & header_tag_mask) >> color_bits, [root, &f](auto tag) {
+	trace(tag, root, f);
+      });
   }
 
-  static void* copy_obj(impl_details::underlying_header_t h, void* root)
+  inline static void count_mark(impl_details::underlying_header_t h)
   {
     using namespace impl_details;
-    auto type_tag = (h & header_tag_mask) >> color_bits;
 
-    if(type_tag == static_cast<uint8_t>(ctrie_internal_types::BV_t)) {
-      using value_type = branch<ctrie_string,
-				int,
-				local_hash<ctrie_string>,
-				otf_ctrie_allocator,
-				otf_ctrie_write_barrier>*;
+    gc_stats::in_phase(gc_phase::mark);
+    gc_stats::marked((h & header_tag_mask) >> color_bits, object_bytes(h));
+  }
+
+  static list<void*> get_derived_ptrs(impl_details::underlying_header_t h, void* root)
+  {
+    list<void*> result;
+
+    count_mark(h);
 
-      size_t n = h >> (color_bits + tag_bits);
-      void* buf = aligned_alloc(alignof(header_t), header_size + n * sizeof(value_type));
+    visit_derived_ptrs(h, root, [&result](void* p) {
+	result.push_front(p);
+      });
 
-      new(reinterpret_cast<header_t*>(buf)) header_t(h);
+    return result;
+  }
 
-      std::memcpy(reinterpret_cast<void*>(reinterpret_cast<std::ptrdiff_t>(buf) + header_size),
-		  root,
-		  n * sizeof(value_type));
+  // Copies the object at root for the write barrier's log, into the log
+  // arena, which frees it once the cycles that could read it are over.
+  // Strings aren't copied. Fresh objects never get here: log_ptr turns
+  // the barrier away from them first.
+  static void* copy_obj(impl_details::underlying_header_t h, void* root)
+  {
+    using namespace impl_details;
+    auto type_tag = (h & header_tag_mask) >> color_bits;
 
-      return reinterpret_cast<void*>(reinterpret_cast<std::ptrdiff_t>(buf) + header_size);
-    } else if(type_tag == static_cast<uint8_t>(ctrie_internal_types::SV_t)) {
+    if(type_tag == static_cast<uint8_t>(ctrie_internal_types::SV_t))
       return nullptr;
-    }
 
-    void* buf = aligned_alloc(alignof(header_t), size_of(h) + header_size);
+    gc_stats::log_ptr_copied();
+
+    size_t n = payload_bytes(h);
+
+    void* buf = log_arena::copies().allocate(header_size + n);
     new(reinterpret_cast<header_t*>(buf)) header_t(h);
 
     std::memcpy(reinterpret_cast<void*>(reinterpret_cast<std::ptrdiff_t>(buf) + header_size),
 		root,
-		size_of(h));
+		n);
 
     return reinterpret_cast<void*>(reinterpret_cast<std::ptrdiff_t>(buf) + header_size);
   }
@@ -449,11 +767,28 @@ public:
     return get_derived_ptrs(h, root);
   }
 
+  template <typename F>
+  inline static void
+  visit_derived_ptrs_of_obj_segment(impl_details::underlying_header_t h, void* root, size_t, F&& f)
+  {
+    count_mark(h);
+    visit_derived_ptrs(h, root, std::forward<F>(f));
+  }
+
+  // The log pointer slot of parent. For an object fresh on this thread
+  // (see fresh_objects), the barrier's check of it is its fast path: it
+  // gets a slot already logged, and makes no copy and no log entry. Each
+  // such store counts as an elided copy.
   inline static impl_details::log_ptr_t*
   log_ptr(impl_details::underlying_header_t h, void* parent, size_t)
   {
     using namespace impl_details;
 
+    if(fresh_objects::contains(parent)) {
+      gc_stats::log_copy_elided();
+      return fresh_objects::logged_slot();
+    }
+
     size_t offset = num_log_ptrs(h);
     auto pd = reinterpret_cast<std::ptrdiff_t>(parent) - header_size - offset * log_ptr_size;
 
@@ -463,93 +798,747 @@ public:
 
 std::unique_ptr<gc> gc::collector;
 
-class otf_ctrie
+// the type tag in the header of the managed object at p.
+inline ctrie_internal_types type_tag_of(const void* p)
+{
+  using namespace impl_details;
+
+  auto hp = reinterpret_cast<const header_t*>(reinterpret_cast<std::ptrdiff_t>(p) - header_size);
+  auto h  = hp->load(std::memory_order_relaxed);
+
+  return static_cast<ctrie_internal_types>((h & header_tag_mask) >> color_bits);
+}
+
+// Reads a snapshot in place, without the generation renewals of
+// ctrie::lookup, so reading it copies nothing.
+template <typename K, typename V, class Hash>
+class snapshot_reader
+{
+private:
+  using types = otf_ctrie_types<K, V, Hash>;
+
+  using inode_type = typename types::inode_type;
+  using cnode_type = typename types::cnode_type;
+  using snode_type = typename types::snode_type;
+  using tnode_type = typename types::tnode_type;
+  using lnode_type = typename types::lnode_type;
+  using failure_type = typename types::failure_type;
+public:
+  // The main node of in, less any GCAS left pending when the snapshot was
+  // taken. Those can't commit, since the snapshot's generation differs
+  // from the inode's, so the previous main node stands.
+  static void* settled_main(void* in)
+  {
+    void* mn = reinterpret_cast<inode_type*>(in)->main.load(std::memory_order_acquire)->derived_ptr();
+    void* prev = nullptr;
+
+    switch(type_tag_of(mn)) {
+    case ctrie_internal_types::Cnode_t:
+      if(auto p = reinterpret_cast<cnode_type*>(mn)->prev.load(std::memory_order_acquire))
+	prev = p->derived_ptr();
+      break;
+    case ctrie_internal_types::Tnode_t:
+      if(auto p = reinterpret_cast<tnode_type*>(mn)->prev.load(std::memory_order_acquire))
+	prev = p->derived_ptr();
+      break;
+    case ctrie_internal_types::Lnode_t:
+      if(auto p = reinterpret_cast<lnode_type*>(mn)->prev.load(std::memory_order_acquire))
+	prev = p->derived_ptr();
+      break;
+    default:
+      break;
+    }
+
+    if(!prev)
+      return mn;
+    else if(type_tag_of(prev) == ctrie_internal_types::Fnode_t)
+      return reinterpret_cast<failure_type*>(prev)->prev->derived_ptr();
+    else
+      return prev;
+  }
+
+  // Calls f(sn) on each snode held directly by the main node mn, and
+  // g(in) on each child inode.
+  template <typename F, typename G>
+  static void for_each_branch(void* mn, F&& f, G&& g)
+  {
+    switch(type_tag_of(mn)) {
+    case ctrie_internal_types::Cnode_t:
+      for(auto& p : reinterpret_cast<cnode_type*>(mn)->arr) {
+	if(!p.get())
+	  continue;
+
+	void* b = p->derived_ptr();
+
+	if(type_tag_of(b) == ctrie_internal_types::Inode_t)
+	  g(b);
+	else
+	  f(reinterpret_cast<const snode_type*>(b));
+      }
+      break;
+    case ctrie_internal_types::Tnode_t:
+      if(auto sn = reinterpret_cast<tnode_type*>(mn)->sn)
+	f(sn);
+      break;
+    case ctrie_internal_types::Lnode_t: {
+      using pl_type = plist_node<snode_type*>;
+
+      auto& ln = *reinterpret_cast<lnode_type*>(mn);
+      auto n = reinterpret_cast<const std::atomic<pl_type*>*>(&ln.contents)->load(std::memory_order_acquire);
+
+      for(; n; n = n->next)
+	if(const snode_type* sn = n->data)
+	  f(sn);
+
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  // looks up k, whose hash is hc, in the snapshot rooted at the inode in,
+  // which sits lev bits down the hash.
+  static const V* lookup(void* in, const K& k, size_t hc, unsigned lev = 0)
+  {
+    using bits = typename types::bits;
+
+    static_assert(8 * sizeof(cnode_type::bmp) == bits::fan_out,
+		  "level_bits must match the width of kl_ctrie's cnode bitmaps.");
+
+    for(; ; lev += types::level_bits) {
+      void* mn = settled_main(in);
+
+      // a cnode past the hash width has no bits left to branch on, so
+      // it's scanned like an lnode instead.
+      if(type_tag_of(mn) == ctrie_internal_types::Cnode_t && lev < bits::hash_bits) {
+	auto cn = reinterpret_cast<cnode_type*>(mn);
+
+	auto bmp = static_cast<typename bits::bitmap_type>(cn->bmp);
+	unsigned idx = bits::index(hc, lev);
+
+	if(!(bmp & bits::flag(idx)))
+	  return nullptr;
+
+	void* b = cn->arr.data()[bits::position(bmp, idx)]->derived_ptr();
+
+	if(type_tag_of(b) == ctrie_internal_types::Inode_t) {
+	  in = b;
+	  continue;
+	}
+
+	auto sn = reinterpret_cast<const snode_type*>(b);
+	return sn->k == k ? &sn->v : nullptr;
+      }
+
+      const V* result = nullptr;
+
+      for_each_branch(mn,
+		      [&](const snode_type* sn) {
+			if(!result && sn->k == k)
+			  result = &sn->v;
+		      },
+		      [&](void* child) {
+			if(!result)
+			  result = lookup(child, k, hc, lev + types::level_bits);
+		      });
+
+      return result;
+    }
+  }
+};
+
+// Runs several read-only lookups at once, AMAC style. Each lookup is a
+// small state machine whose steps make one dependent load and prefetch
+// the target of the next, then yield to the other lookups in flight, so
+// their cache misses overlap. The walk mirrors kl_ctrie's lookup: a cnode
+// branches on level_bits bits of the hash, and a branch is located by
+// its popcount in the cnode's bitmap. Anything unusual (a pending GCAS,
+// a tnode or lnode, an RDCSS root) hands the key to ctrie::lookup.
+template <typename K, typename V, class Hash>
+class interleaved_lookup
+{
+private:
+  using types = otf_ctrie_types<K, V, Hash>;
+
+  using inode_type = typename types::inode_type;
+  using cnode_type = typename types::cnode_type;
+  using snode_type = typename types::snode_type;
+  using branch_type = typename types::branch_type;
+
+  using main_ptr = decltype(std::declval<inode_type&>().main.load());
+  using branch_slot = std::remove_pointer_t<decltype(std::declval<cnode_type&>().arr.data())>;
+
+  static const unsigned level_bits = types::level_bits;
+
+  using bits = typename types::bits;
+
+  enum class stage : uint8_t
+  {
+    inode, // node is an inode: read its main node.
+    main, // node is a main node: read the cnode bitmap.
+    slot, // node is a branch slot: read the branch.
+    branch, // node is a branch: find whether it's an inode or snode.
+    key, // node is an snode: compare its key.
+    done,
+    slow
+  };
+
+  struct lookup_state
+  {
+    K key;
+    size_t hc;
+    unsigned lev;
+    stage st;
+    const void* node;
+    const V* result;
+    size_t index;
+  };
+
+  inline static void prefetch(const void* p)
+  {
+    __builtin_prefetch(p);
+  }
+
+  inline static void step(lookup_state& s)
+  {
+    static_assert(8 * sizeof(cnode_type::bmp) == bits::fan_out,
+		  "level_bits must match the width of kl_ctrie's cnode bitmaps.");
+
+    switch(s.st) {
+    case stage::inode: {
+      auto in = reinterpret_cast<const inode_type*>(s.node);
+      main_ptr mn = in->main.load(std::memory_order_acquire);
+
+      if(!mn) {
+	s.st = stage::slow;
+	return;
+      }
+
+      prefetch(mn);
+      s.node = mn;
+      s.st = stage::main;
+
+      return;
+    }
+    case stage::main: {
+      void* d = reinterpret_cast<main_ptr>(const_cast<void*>(s.node))->derived_ptr();
+
+      if(type_tag_of(d) != ctrie_internal_types::Cnode_t) {
+	s.st = stage::slow;
+	return;
+      }
+
+      auto cn = reinterpret_cast<cnode_type*>(d);
+
+      // past the hash width, the cnode can't be indexed by hc. kl_ctrie
+      // keeps such keys in an lnode, which ctrie::lookup scans.
+      if(s.lev >= bits::hash_bits || cn->prev.load(std::memory_order_acquire)) {
+	s.st = stage::slow;
+	return;
+      }
+
+      auto bmp = static_cast<typename bits::bitmap_type>(cn->bmp);
+      unsigned idx = bits::index(s.hc, s.lev);
+
+      if(!(bmp & bits::flag(idx))) {
+	s.result = nullptr;
+	s.st = stage::done;
+	return;
+      }
+
+      const branch_slot* bs = cn->arr.data() + bits::position(bmp, idx);
+
+      prefetch(bs);
+      s.node = bs;
+      s.lev += level_bits;
+      s.st = stage::slot;
+
+      return;
+    }
+    case stage::slot: {
+      const branch_type* b = reinterpret_cast<const branch_slot*>(s.node)->get();
+
+      prefetch(b);
+      s.node = b;
+      s.st = stage::branch;
+
+      return;
+    }
+    case stage::branch: {
+      void* d = const_cast<branch_type*>(reinterpret_cast<const branch_type*>(s.node))->derived_ptr();
+
+      switch(type_tag_of(d)) {
+      case ctrie_internal_types::Inode_t:
+	s.node = d;
+	s.st = stage::inode;
+	return step(s);
+      case ctrie_internal_types::Snode_t:
+	if constexpr(is_ref_string<K>::value)
+	  if(!reinterpret_cast<const snode_type*>(d)->k.inlined())
+	    prefetch(reinterpret_cast<const snode_type*>(d)->k.data());
+
+	s.node = d;
+	s.st = stage::key;
+	return;
+      default:
+	s.st = stage::slow;
+	return;
+      }
+    }
+    case stage::key: {
+      auto sn = reinterpret_cast<const snode_type*>(s.node);
+
+      s.result = sn->k == s.key ? &sn->v : nullptr;
+      s.st = stage::done;
+
+      return;
+    }
+    default:
+      return;
+    }
+  }
+public:
+  static constexpr size_t max_group_size = 32;
+
+  // Looks up keys[0], ..., keys[n - 1] from root, writing the results to
+  // out[0], ..., out[n - 1]. probe turns a key into a K, slow runs a
+  // lookup through the ctrie. Nothing is held past the return, so the
+  // caller may poll for a handshake between runs.
+  template <typename RandomIt, typename RandomOutIt, typename Probe, typename Slow>
+  static void run(void* root, RandomIt keys, size_t n, RandomOutIt out, size_t group_size,
+		  Probe&& probe, Slow&& slow)
+  {
+    std::optional<lookup_state> slots[max_group_size];
+
+    const bool root_is_inode = type_tag_of(root) == ctrie_internal_types::Inode_t;
+    size_t next = 0, live = 0;
+
+    group_size = std::max<size_t>(1, std::min(group_size, max_group_size));
+
+    auto start = [&](std::optional<lookup_state>& slot) {
+      K key = probe(keys[next]);
+      size_t hc = Hash()(key);
+
+      slot.emplace(lookup_state { key,
+				  hc,
+				  0,
+				  root_is_inode ? stage::inode : stage::slow,
+				  root,
+				  nullptr,
+				  next++ });
+    };
+
+    for(; live < group_size && next < n; ++live)
+      start(slots[live]);
+
+    while(live > 0) {
+      for(size_t i = 0; i < group_size; ++i) {
+	if(!slots[i])
+	  continue;
+
+	lookup_state& s = *slots[i];
+	step(s);
+
+	if(s.st == stage::done || s.st == stage::slow) {
+	  out[s.index] = s.st == stage::done ? s.result : slow(s.key);
+
+	  if(next < n)
+	    start(slots[i]);
+	  else {
+	    slots[i].reset();
+	    --live;
+	  }
+	}
+      }
+    }
+  }
+};
+
+template <typename K, typename V, class Hash = local_hash<K>>
+class basic_otf_ctrie
 {
 private:
   inline void poll_for_sync()
   {
-    mt()->poll_for_sync();
+    ::poll_for_sync();
   }
 
-  using inst_ctrie = ctrie<ctrie_string,
-			   int,
-			   local_hash<ctrie_string>,
-			   otf_ctrie_allocator,
-			   otf_ctrie_write_barrier>;
+  using types = otf_ctrie_types<K, V, Hash>;
+  using inst_ctrie = typename types::ctrie_type;
+
+  friend class basic_otf_ctrie_view<K, V, Hash>;
 
   inst_ctrie ct;
+  scoped_root root;
   
-  otf_ctrie(inst_ctrie ct_) : ct(ct_) {}
+  basic_otf_ctrie(inst_ctrie ct_) : ct(ct_), root(*this) {}
+
+  inline static const K& probe_key(const K& k)
+  {
+    return k;
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline static K probe_key(std::string_view k)
+  {
+    return Q::borrow(k.data(), k.size());
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline static K probe_key(const char* k)
+  {
+    return probe_key(std::string_view(k));
+  }
+
+  inline static bool poll_due(size_t i, size_t poll_interval)
+  {
+    return poll_interval == 0 ? i == 0 : i % poll_interval == 0;
+  }
 public:  
-  otf_ctrie snapshot()
+  using key_type = K;
+  using mapped_type = V;
+  using hasher = Hash;
+
+  basic_otf_ctrie snapshot()
   {
     return ct.snapshot();
   }
 
-  list<void*> ct_callback()
+  // A read-only view of a snapshot(). Taking it costs the live trie's
+  // writers exactly what snapshot() does: the trie moves to a new
+  // generation, and writers renew each inode they pass. A Ctrie can't
+  // offer a snapshot without that, since the renewals are what keep the
+  // snapshot's nodes from changing under it. What the view spares is
+  // its own reads: they go through snapshot_reader, so unlike lookups
+  // on snapshot() they never renew (copy) inodes on the snapshot side.
+  basic_otf_ctrie_view<K, V, Hash> snapshot_view()
+  {
+    return basic_otf_ctrie_view<K, V, Hash>(ct.snapshot());
+  }
+
+  void* root_ptr(std::memory_order order = std::memory_order_relaxed)
   {
-    using root_type = kl_ctrie::inode_or_rdcss<ctrie_string,
-					       int,
-					       local_hash<ctrie_string>,
-					       otf_ctrie_allocator,
-					       otf_ctrie_write_barrier>*;
+    using root_type = typename types::root_type;
+    using root_barrier = typename types::template write_barrier<std::atomic<root_type>>;
 
-    otf_ctrie_write_barrier<std::atomic<root_type>>& rt =
-      *reinterpret_cast<otf_ctrie_write_barrier<std::atomic<root_type>>*>(&ct);
+    root_barrier& rt = *reinterpret_cast<root_barrier*>(&ct);
 
-    auto item = rt.load(std::memory_order_relaxed);
-    return list<void*>({ item->derived_ptr() });
+    auto item = rt.load(order);
+    return item->derived_ptr();
   }
 
-  otf_ctrie() : ct(inst_ctrie())
+  list<void*> ct_callback()
   {
-    mt()->set_root_callback([this]() {
-	return this->ct_callback();
-      });
+    return list<void*>({ root_ptr() });
+  }
+
+  basic_otf_ctrie() : ct(inst_ctrie()), root(*this) {}
+
+  // Each copy registers its own root, so a copy of a snapshot outliving
+  // the snapshot is still scanned.
+  basic_otf_ctrie(const basic_otf_ctrie& o) : ct(o.ct), root(*this) {}
+
+  basic_otf_ctrie& operator=(const basic_otf_ctrie& o)
+  {
+    ct = o.ct;
+    return *this;
   }
 
-  inline void insert(ctrie_string k, int v)
+  inline void insert(const K& k, const V& v)
   {
     poll_for_sync();
     ct.insert(k, v);
   }
 
-  inline const int* remove(ctrie_string k)
+  inline const V* remove(const K& k)
   {
     poll_for_sync();
     return ct.remove(k);
   }
 
-  inline const int* lookup(ctrie_string k)
+  inline const V* lookup(const K& k)
   {
     poll_for_sync();
     return ct.lookup(k);
   }
+
+  // Looks k up by hc, its hash as the caller computed it, as
+  // basic_otf_wide_ctrie does to pick a subtrie. The walk is
+  // snapshot_reader's, through the committed main node of each inode;
+  // only while an RDCSS holds the root does the lookup go to kl_ctrie,
+  // which hashes k again.
+  inline const V* lookup(const K& k, size_t hc)
+  {
+    poll_for_sync();
+
+    void* r = root_ptr(std::memory_order_acquire);
+
+    if(type_tag_of(r) != ctrie_internal_types::Inode_t)
+      return ct.lookup(k);
+
+    return snapshot_reader<K, V, Hash>::lookup(r, k, hc);
+  }
+
+  // Lookups and removals by bytes compare against snode keys in place,
+  // through a borrowed key, and so allocate nothing in the GC heap.
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* remove(std::string_view k)
+  {
+    poll_for_sync();
+    return ct.remove(probe_key(k));
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* remove(const char* k)
+  {
+    return remove(std::string_view(k));
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* lookup(std::string_view k)
+  {
+    poll_for_sync();
+    return ct.lookup(probe_key(k));
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* lookup(const char* k)
+  {
+    return lookup(std::string_view(k));
+  }
+
+  // The batched operations poll for a handshake once every poll_interval
+  // operations, and at least once per batch, instead of once per
+  // operation. Between polls the collector's handshakes wait on this
+  // mutator, so a smaller interval keeps collection cycles shorter. An
+  // interval of 0 polls only as the batch starts.
+  static const size_t default_poll_interval = 64;
+
+  // inserts each (key, value) pair in [first, last). Handshakes are
+  // answered between inserts, so keys and values allocated in the GC
+  // heap must stay reachable from a root until they're inserted: those
+  // held in a plain container need a scoped_root apiece.
+  template <typename InputIt>
+  void insert_many(InputIt first, InputIt last, size_t poll_interval = default_poll_interval)
+  {
+    for(size_t i = 0; first != last; ++first, ++i) {
+      if(poll_due(i, poll_interval))
+	poll_for_sync();
+
+      ct.insert(first->first, first->second);
+    }
+  }
+
+  // writes the result of looking up each key in [first, last) to out.
+  template <typename InputIt, typename OutputIt>
+  OutputIt lookup_many(InputIt first, InputIt last, OutputIt out,
+		       size_t poll_interval = default_poll_interval)
+  {
+    for(size_t i = 0; first != last; ++first, ++i) {
+      if(poll_due(i, poll_interval))
+	poll_for_sync();
+
+      *out++ = ct.lookup(probe_key(*first));
+    }
+
+    return out;
+  }
+
+  // Like lookup_many, but runs up to group_size lookups interleaved with
+  // one another (see interleaved_lookup) to hide memory latency on tries
+  // too large for the cache. Both iterators must be random access.
+  template <typename RandomIt, typename RandomOutIt>
+  RandomOutIt lookup_many_interleaved(RandomIt first, RandomIt last, RandomOutIt out,
+				      size_t group_size = 8,
+				      size_t poll_interval = default_poll_interval)
+  {
+    using lookup = interleaved_lookup<K, V, Hash>;
+
+    auto probe = [](const auto& k) -> K { return probe_key(k); };
+    auto slow  = [this](const K& k) { return ct.lookup(k); };
+
+    while(first != last) {
+      size_t n = poll_interval == 0
+	? last - first
+	: std::min<size_t>(last - first, std::max(poll_interval, group_size));
+
+      poll_for_sync();
+      lookup::run(root_ptr(std::memory_order_acquire), first, n, out, group_size, probe, slow);
+
+      first += n;
+      out += n;
+    }
+
+    return out;
+  }
+
+  // writes the result of removing each key in [first, last) to out.
+  template <typename InputIt, typename OutputIt>
+  OutputIt remove_many(InputIt first, InputIt last, OutputIt out,
+		       size_t poll_interval = default_poll_interval)
+  {
+    for(size_t i = 0; first != last; ++first, ++i) {
+      if(poll_due(i, poll_interval))
+	poll_for_sync();
+
+      *out++ = ct.remove(probe_key(*first));
+    }
+
+    return out;
+  }
 };
 
-const std::function<list<void*>(void*)> otf_ctrie_tracer::tracer_table[] = {
-  trace_inode,
-  trace_cnode,
-  trace_snode,
-  trace_tnode,
-  trace_lnode,
-  trace_failure,
-  trace_branch_vector,
-  trace_string,
-  trace_plist_node,
-  trace_rdcss_desc
+template <typename K, typename V, class Hash>
+class basic_otf_ctrie_view
+{
+private:
+  friend class basic_otf_ctrie<K, V, Hash>;
+
+  using reader = snapshot_reader<K, V, Hash>;
+
+  basic_otf_ctrie<K, V, Hash> ss;
+
+  basic_otf_ctrie_view(typename otf_ctrie_types<K, V, Hash>::ctrie_type ct) : ss(ct) {}
+
+  inline const V* find(const K& k)
+  {
+    void* root;
+
+    // an RDCSS on the root completes promptly; wait for the inode.
+    while(type_tag_of(root = ss.root_ptr(std::memory_order_acquire)) != ctrie_internal_types::Inode_t)
+      std::this_thread::yield();
+
+    return reader::lookup(root, k, Hash()(k));
+  }
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using hasher = Hash;
+
+  void* root_ptr(std::memory_order order = std::memory_order_relaxed)
+  {
+    return ss.root_ptr(order);
+  }
+
+  list<void*> ct_callback()
+  {
+    return ss.ct_callback();
+  }
+
+  inline const V* lookup(const K& k)
+  {
+    poll_for_sync();
+    return find(k);
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* lookup(std::string_view k)
+  {
+    poll_for_sync();
+    return find(Q::borrow(k.data(), k.size()));
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* lookup(const char* k)
+  {
+    return lookup(std::string_view(k));
+  }
 };
 
-const std::function<void(void*)> otf_ctrie_policy::destructor_table[] = {
-  destroy_type<inode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>,
-  destroy_type<cnode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>,
-  destroy_type<snode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>,
-  destroy_type<tnode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>,
-  destroy_type<lnode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>,
-  destroy_type<failure<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>,
-  destroy_vector,
-  destroy_vector,
-  destroy_type<plist_node<snode<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>>,
-  destroy_type<rdcss_descriptor<ctrie_string, int, local_hash<ctrie_string>, otf_ctrie_allocator, otf_ctrie_write_barrier>>
+// A ctrie whose root level is a fixed array of 2^RootBits subtries,
+// picked by the top RootBits bits of a key's hash. The array is never
+// copied, so writers don't contend on a root cnode, and each subtrie
+// holds 2^RootBits times fewer keys, sparing as many levels. Lookups
+// hash a key once, handing the hash that picks its subtrie on to the
+// subtrie's lookup. kl_ctrie's insert and remove take no hash, so the
+// subtrie hashes their keys again.
+//
+// Snapshots of the subtries would not be taken atomically together, so
+// none are offered.
+template <typename K, typename V, class Hash = local_hash<K>, unsigned RootBits = 12>
+class basic_otf_wide_ctrie
+{
+private:
+  static_assert(RootBits > 0 && RootBits <= 16, "the root level takes 1 to 16 hash bits.");
+
+  using subtrie = basic_otf_ctrie<K, V, Hash>;
+
+  std::vector<subtrie> subtries;
+
+  inline subtrie& subtrie_of(size_t hc)
+  {
+    return subtries[hc >> (std::numeric_limits<size_t>::digits - RootBits)];
+  }
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using hasher = Hash;
+
+  static const size_t root_width = size_t(1) << RootBits;
+
+  // Each subtrie registers its own root.
+  basic_otf_wide_ctrie() : subtries(root_width) {}
+
+  basic_otf_wide_ctrie(const basic_otf_wide_ctrie&) = delete;
+
+  list<void*> ct_callback()
+  {
+    list<void*> l;
+
+    for(auto& st : subtries)
+      l.push_front(st.root_ptr());
+
+    return l;
+  }
+
+  // the root of subtrie i.
+  void* root_ptr(size_t i, std::memory_order order = std::memory_order_relaxed)
+  {
+    return subtries[i].root_ptr(order);
+  }
+
+  inline void insert(const K& k, const V& v)
+  {
+    subtrie_of(Hash()(k)).insert(k, v);
+  }
+
+  inline const V* remove(const K& k)
+  {
+    return subtrie_of(Hash()(k)).remove(k);
+  }
+
+  inline const V* lookup(const K& k)
+  {
+    size_t hc = Hash()(k);
+    return subtrie_of(hc).lookup(k, hc);
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* remove(std::string_view k)
+  {
+    return remove(Q::borrow(k.data(), k.size()));
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* lookup(std::string_view k)
+  {
+    return lookup(Q::borrow(k.data(), k.size()));
+  }
+
+  template <typename Q = K, typename = std::enable_if_t<is_ref_string<Q>::value>>
+  inline const V* lookup(const char* k)
+  {
+    return lookup(std::string_view(k));
+  }
 };
+
+using otf_ctrie_policy = basic_otf_ctrie_policy<ctrie_string, int>;
+using otf_ctrie_tracer = basic_otf_ctrie_tracer<ctrie_string, int>;
+using otf_ctrie = basic_otf_ctrie<ctrie_string, int>;
+using otf_ctrie_view = basic_otf_ctrie_view<ctrie_string, int>;
+
+template <unsigned RootBits = 12>
+using otf_wide_ctrie = basic_otf_wide_ctrie<ctrie_string, int, local_hash<ctrie_string>, RootBits>;
+
 #endif
@@ -0,0 +1,204 @@
+#ifndef PARALLEL_TRAVERSAL_HPP_INCLUDED
+#define PARALLEL_TRAVERSAL_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "otf_ctrie.hpp"
+
+// Visits every entry of a snapshot on a set of worker threads, one inode
+// subtree per task. Workers pop tasks depth first from the back of their
+// own deque and steal from the front of the others', where the larger
+// subtrees near the root sit.
+//
+// Each worker is a registered mutator that registers the snapshot as a
+// root, and it polls for handshakes as it goes, so the collector
+// keeps running during a traversal. The snapshot must not be written to
+// while it is traversed.
+template <class Snapshot>
+class parallel_traversal
+{
+private:
+  using K = typename Snapshot::key_type;
+  using V = typename Snapshot::mapped_type;
+
+  using reader = snapshot_reader<K, V, typename Snapshot::hasher>;
+
+  struct task_deque
+  {
+    std::mutex m;
+    std::deque<void*> tasks;
+  };
+
+  static const size_t poll_interval = 256;
+
+  Snapshot& ss;
+
+  const size_t num_workers;
+  std::unique_ptr<task_deque[]> deques;
+
+  // tasks pushed but not yet finished. Workers stop when it reaches zero.
+  std::atomic<size_t> pending;
+
+  void push(size_t w, void* in)
+  {
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(deques[w].m);
+    deques[w].tasks.push_back(in);
+  }
+
+  bool pop(size_t w, void*& in)
+  {
+    std::lock_guard<std::mutex> lock(deques[w].m);
+
+    if(deques[w].tasks.empty())
+      return false;
+
+    in = deques[w].tasks.back();
+    deques[w].tasks.pop_back();
+
+    return true;
+  }
+
+  bool steal(size_t w, void*& in)
+  {
+    for(size_t i = 1; i < num_workers; ++i) {
+      auto& victim = deques[(w + i) % num_workers];
+      std::lock_guard<std::mutex> lock(victim.m);
+
+      if(!victim.tasks.empty()) {
+	in = victim.tasks.front();
+	victim.tasks.pop_front();
+
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  template <typename F>
+  void visit(size_t w, void* in, F& f)
+  {
+    reader::for_each_branch(reader::settled_main(in),
+			    [&f](const auto* sn) { f(sn->k, sn->v); },
+			    [this, w](void* child) { push(w, child); });
+  }
+
+  template <typename F>
+  void work(size_t w, F& f)
+  {
+    // the snapshot's root, in this worker's mutator's roots.
+    scoped_root root(ss);
+
+    void* in;
+    size_t visited = 0;
+
+    while(pending.load(std::memory_order_acquire) > 0) {
+      if(pop(w, in) || steal(w, in)) {
+	visit(w, in, f);
+	pending.fetch_sub(1, std::memory_order_acq_rel);
+
+	if(++visited % poll_interval == 0)
+	  poll_for_sync();
+      } else {
+	poll_for_sync();
+	std::this_thread::yield();
+      }
+    }
+  }
+public:
+  parallel_traversal(Snapshot& ss_, size_t num_workers_)
+    : ss(ss_),
+      num_workers(std::max<size_t>(1, num_workers_)),
+      deques(new task_deque[num_workers]),
+      pending(0)
+  {}
+
+  // Runs fs[w] on worker w for each entry that worker visits, as
+  // fs[w](key, value). fs must hold one function per worker.
+  template <typename F>
+  void run(std::vector<F>& fs)
+  {
+    void* root;
+
+    // an RDCSS on the root completes promptly; wait for the inode.
+    while(type_tag_of(root = ss.root_ptr(std::memory_order_acquire)) != ctrie_internal_types::Inode_t)
+      std::this_thread::yield();
+
+    push(0, root);
+
+    std::vector<std::future<void>> workers;
+    workers.reserve(num_workers);
+
+    for(size_t w = 0; w < num_workers; ++w)
+      workers.push_back(std::async(std::launch::async, [this, w, &fs]() {
+	    work(w, fs[w]);
+	  }));
+
+    // the calling mutator keeps answering handshakes while it waits.
+    for(auto& worker : workers)
+      while(worker.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+	poll_for_sync();
+
+    for(auto& worker : workers)
+      worker.get();
+  }
+};
+
+// Calls f(key, value) for every entry of the snapshot ss, concurrently
+// from num_workers threads. ss is a snapshot() or snapshot_view().
+template <class Snapshot, typename F>
+void parallel_for_each(Snapshot& ss, F f,
+		       size_t num_workers = std::thread::hardware_concurrency())
+{
+  parallel_traversal<Snapshot> traversal(ss, num_workers);
+  std::vector<F> fs(std::max<size_t>(1, num_workers), f);
+
+  traversal.run(fs);
+}
+
+// Folds map(key, value) over every entry of the snapshot ss with reduce.
+// Each worker folds its share from init, and the per-worker results are
+// folded together from init, so init must be an identity of reduce.
+template <class Snapshot, typename T, typename Map, typename Reduce>
+T parallel_map_reduce(Snapshot& ss, Map map, Reduce reduce, T init,
+		      size_t num_workers = std::thread::hardware_concurrency())
+{
+  using K = typename Snapshot::key_type;
+  using V = typename Snapshot::mapped_type;
+
+  num_workers = std::max<size_t>(1, num_workers);
+
+  std::vector<T> accs(num_workers, init);
+
+  auto folder = [&map, &reduce](T& acc) {
+    return [&map, &reduce, &acc](const K& k, const V& v) {
+      acc = reduce(acc, map(k, v));
+    };
+  };
+
+  std::vector<decltype(folder(accs[0]))> fs;
+
+  for(size_t w = 0; w < num_workers; ++w)
+    fs.push_back(folder(accs[w]));
+
+  parallel_traversal<Snapshot> traversal(ss, num_workers);
+  traversal.run(fs);
+
+  T result = init;
+
+  for(auto& acc : accs)
+    result = reduce(result, acc);
+
+  return result;
+}
+#endif
@@ -1,21 +1,100 @@
 #ifndef REF_STRING_HPP_INCLUDED
 #define REF_STRING_HPP_INCLUDED
 
+#include <atomic>
 #include <cstring>
+#include <new>
 #include <ostream>
+#include <type_traits>
 
-template <class Alloc>
+#include "local_hash.hpp"
+
+template <class Alloc, bool CacheHash, size_t InlineLen>
 class ref_string;
 
-template <class Alloc>
-std::ostream& operator<<(std::ostream&, const ref_string<Alloc>&);
+template <class Alloc, bool CacheHash, size_t InlineLen>
+std::ostream& operator<<(std::ostream&, const ref_string<Alloc, CacheHash, InlineLen>&);
 
-template <class Alloc = std::allocator<char>>
+// With InlineLen, strings of up to InlineLen characters are kept in the
+// ref_string itself, and so in whatever holds it, rather than in a
+// separate allocation.
+template <class Alloc = std::allocator<char>, bool CacheHash = false, size_t InlineLen = 0>
 class ref_string
 {
 private:
+  static constexpr size_t inline_size =
+    InlineLen + 1 > sizeof(char*) ? InlineLen + 1 : sizeof(char*);
+
   size_t n;
-  char* str;
+
+  union {
+    char* str;
+    char buf[inline_size];
+  };
+
+  // With CacheHash, the hash lives in the word after the terminating
+  // null, shared by every copy of the string. Zero means not computed.
+  static constexpr size_t hash_slot_offset(size_t n_)
+  {
+    return (n_ + alignof(size_t)) & ~(alignof(size_t) - 1);
+  }
+
+  static constexpr size_t alloc_size(size_t n_)
+  {
+    return CacheHash ? hash_slot_offset(n_) + sizeof(std::atomic<size_t>) : n_ + 1;
+  }
+
+  // Borrowed strings view bytes the collector doesn't own, standing in
+  // for keys that live no longer than a lookup. They're marked by the top
+  // bit of n, have no hash slot and are never recolored on copy.
+  static constexpr size_t borrowed_bit = ~(~size_t(0) >> 1);
+
+  ref_string(size_t n_, const char* s)
+    : n(n_ | borrowed_bit), str(const_cast<char*>(s))
+  {}
+
+  inline size_t len() const
+  {
+    return n & ~borrowed_bit;
+  }
+
+  inline static constexpr bool fits_inline(size_t n_)
+  {
+    return InlineLen > 0 && n_ <= InlineLen;
+  }
+
+  // the characters' home, allocating it if they don't fit inline.
+  inline char* claim(size_t n_)
+  {
+    n = n_;
+
+    if(fits_inline(n))
+      return buf;
+
+    str = reinterpret_cast<char*>(Alloc().allocate(alloc_size(n)));
+    return str;
+  }
+
+  inline void copy_from(const ref_string& ss)
+  {
+    n = ss.n;
+
+    if(ss.inlined())
+      std::memcpy(buf, ss.buf, inline_size);
+    else
+      str = ss.borrowed() ? ss.str : Alloc::shallow_copy_ref_string(ss.str);
+  }
+
+  inline std::atomic<size_t>* hash_slot() const
+  {
+    return reinterpret_cast<std::atomic<size_t>*>(str + hash_slot_offset(len()));
+  }
+
+  inline void init_hash_slot()
+  {
+    if(CacheHash && !inlined())
+      new(hash_slot()) std::atomic<size_t>(0);
+  }
 
   struct iterator {
     char* i;
@@ -83,86 +162,139 @@ private:
     }
   };
   
-  friend std::ostream& operator<< <>(std::ostream&, const ref_string<Alloc>&);  
+  friend std::ostream& operator<< <>(std::ostream&, const ref_string<Alloc, CacheHash, InlineLen>&);
 public:
   ref_string(const ref_string& ss)
-    : n(ss.n), str(Alloc::shallow_copy_ref_string(ss.str))
   {
+    copy_from(ss);
   }
   
   ref_string(size_t n_, char c)
-    : n(n_), str(reinterpret_cast<char*>(Alloc().allocate(n + 1)))
   {
-    std::fill(str, str + n, c);
-    str[n] = '\0';
+    char* p = claim(n_);
+
+    std::fill(p, p + n, c);
+    p[n] = '\0';
+    init_hash_slot();
   }
 
   ref_string(const char* s)
-    : n(std::strlen(s)), str(reinterpret_cast<char*>(Alloc().allocate(n + 1)))
   {
-    std::strcpy(str, s);
+    char* p = claim(std::strlen(s));
+
+    std::memcpy(p, s, n + 1);
+    init_hash_slot();
   }
 
   inline const_iterator cbegin() const {
-    return const_iterator { str };
+    return const_iterator { data() };
   }
   
   inline const_iterator cend() const {
-    return const_iterator { str + n };
+    return const_iterator { data() + len() };
   }
   
   inline iterator begin()
   {
-    return iterator { str };
+    return iterator { const_cast<char*>(data()) };
   }
   
   inline iterator end()
   {
-    return iterator { str + n };
+    return iterator { const_cast<char*>(data()) + len() };
   }
   
+  // a string viewing the n bytes at s in place. It must not outlive them,
+  // so it is for lookups only and must never be inserted.
+  static ref_string borrow(const char* s, size_t n)
+  {
+    return ref_string(n, s);
+  }
+
+  inline bool borrowed() const
+  {
+    return n & borrowed_bit;
+  }
+
+  // whether the characters are stored in the ref_string itself. The top
+  // bit of a borrowed string's n keeps it from ever counting as inline.
+  inline bool inlined() const
+  {
+    return fits_inline(n);
+  }
+
   inline size_t size() const
   {
-    return n;
+    return len();
   }
   
   inline char& operator[](size_t i)
   {
-    return str[i];
+    return const_cast<char*>(data())[i];
+  }
+
+  inline size_t hash() const
+  {
+    if(borrowed() || inlined())
+      return hash_bytes(data(), len());
+
+    if constexpr(CacheHash) {
+      auto slot = hash_slot();
+      size_t h = slot->load(std::memory_order_relaxed);
+
+      if(h == 0) {
+	h = hash_bytes(str, len());
+	slot->store(h, std::memory_order_relaxed);
+      }
+
+      return h;
+    } else {
+      return hash_bytes(str, len());
+    }
   }
 
   inline bool operator==(const ref_string& ss) const
   {
-    return n == ss.n && !std::strcmp(str, ss.str);
+    if(len() != ss.len())
+      return false;
+
+    if constexpr(CacheHash) {
+      if(!borrowed() && !ss.borrowed() && !inlined() && !ss.inlined()) {
+	size_t h  = hash_slot()->load(std::memory_order_relaxed);
+	size_t sh = ss.hash_slot()->load(std::memory_order_relaxed);
+
+	if(h && sh && h != sh)
+	  return false;
+      }
+    }
+
+    return data() == ss.data() || !std::memcmp(data(), ss.data(), len());
   }
   
   inline bool operator==(const char* str_) const
   {
-    return !std::strcmp(str, str_);
+    return len() == std::strlen(str_) && !std::memcmp(data(), str_, len());
   }
 
   inline ref_string& operator=(const char* str_)
   {
-    n = std::strlen(str_);    
-    str = Alloc().allocate(n + 1);
+    char* p = claim(std::strlen(str_));
 
-    std::strcpy(str, str_);
+    std::memcpy(p, str_, n + 1);
+    init_hash_slot();
 
     return *this;
   }
   
   inline ref_string& operator=(const ref_string& ss)
   {
-    n = ss.n;    
-    str = Alloc::shallow_copy_ref_string(ss.str);
-
+    copy_from(ss);
     return *this;
   }
 
   inline ref_string& operator=(ref_string&& ss)
   {
-    n = ss.n;    
-    str = Alloc::shallow_copy_ref_string(ss.str);
+    copy_from(ss);
 
     ss.n = 0; ss.str = nullptr;
 
@@ -171,14 +303,22 @@ public:
   
   inline const char* data() const
   {
-    return str;
+    return inlined() ? buf : str;
   }  
 };
 
-template <class Alloc>
-std::ostream& operator<<(std::ostream& os, const ref_string<Alloc>& ss)
+template <class Alloc, bool CacheHash, size_t InlineLen>
+std::ostream& operator<<(std::ostream& os, const ref_string<Alloc, CacheHash, InlineLen>& ss)
 {
-  os << ss.str;
+  os.write(ss.data(), ss.len());
   return os;
 }
+
+template <class>
+struct is_ref_string : std::false_type
+{};
+
+template <class Alloc, bool CacheHash, size_t InlineLen>
+struct is_ref_string<ref_string<Alloc, CacheHash, InlineLen>> : std::true_type
+{};
 #endif
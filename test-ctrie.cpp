@@ -1,10 +1,24 @@
 #include <iostream>
 #include <future>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <functional>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <type_traits>
+#include <unordered_set>
+#include <vector>
 
+#include "log_arena.hpp"
 #include "otf_ctrie.hpp"
+#include "parallel_traversal.hpp"
 #include "gtest/gtest.h"
 #include "test-ctrie.hpp"
 
@@ -35,6 +49,93 @@ TEST_F(ctrie_tests, RemoveAndCantBeFound)
   ASSERT_EQ(*ct.lookup("aaaaa"), 5);
 }
 
+TEST_F(ctrie_tests, LookupAndRemoveByStringView)
+{
+  for(char c = 'a'; c <= 'z'; ++c) {
+    for(int i = 1; i < 65; ++i) {
+      std::string key(i, c);
+      auto ptr = ct.lookup(std::string_view(key));
+
+      ASSERT_NE(ptr, nullptr);
+      ASSERT_EQ(*ptr, i);
+    }
+  }
+
+  std::string key(33, 'q');
+
+  ASSERT_NE(ct.remove(std::string_view(key)), nullptr);
+  ASSERT_EQ(ct.lookup(std::string_view(key)), nullptr);
+  ASSERT_EQ(ct.lookup(ctrie_string(33, 'q')), nullptr);
+}
+
+TEST_F(ctrie_tests, BatchedInsertsLookupsAndRemoves)
+{
+  std::vector<std::pair<ctrie_string, int>> entries;
+  std::vector<std::string> keys;
+
+  for(unsigned lenn = 65; lenn < 1000; lenn += 10) {
+    entries.emplace_back(ctrie_string(lenn, 'b'), lenn);
+    keys.emplace_back(lenn, 'b');
+  }
+
+  // the keys are collectable until they're inserted, and insert_many
+  // answers handshakes on the way.
+  std::deque<scoped_root> key_roots;
+
+  for(auto& entry : entries)
+    key_roots.emplace_back(&entry.first, [](const void* k) -> void* {
+	return const_cast<char*>(static_cast<const ctrie_string*>(k)->data());
+      });
+
+  ct.insert_many(entries.begin(), entries.end(), 7);
+
+  std::vector<std::string_view> views(keys.begin(), keys.end());
+  std::vector<const int*> results;
+
+  ct.lookup_many(views.begin(), views.end(), std::back_inserter(results));
+
+  ASSERT_EQ(results.size(), entries.size());
+
+  for(size_t i = 0; i < results.size(); ++i) {
+    ASSERT_NE(results[i], nullptr);
+    ASSERT_EQ(*results[i], entries[i].second);
+  }
+
+  results.clear();
+  ct.lookup_many(views.begin(), views.end(), std::back_inserter(results), 0);
+
+  for(size_t i = 0; i < results.size(); ++i)
+    ASSERT_EQ(results[i], ct.lookup(views[i]));
+
+  results.clear();
+  ct.remove_many(views.begin(), views.end(), std::back_inserter(results), 1);
+
+  for(size_t i = 0; i < results.size(); ++i)
+    ASSERT_NE(results[i], nullptr);
+
+  for(auto& key : views)
+    ASSERT_EQ(ct.lookup(key), nullptr);
+}
+
+TEST_F(ctrie_tests, InterleavedLookupsMatchSequentialLookups)
+{
+  std::vector<std::string> keys;
+
+  for(char c = 'a'; c <= 'z'; ++c)
+    for(int i = 1; i < 80; ++i)
+      keys.emplace_back(i, c);
+
+  std::vector<std::string_view> views(keys.begin(), keys.end());
+  std::vector<const int*> results(views.size());
+
+  for(size_t group_size : { 1, 4, 16 }) {
+    ct.lookup_many_interleaved(views.begin(), views.end(), results.begin(), group_size);
+
+    for(size_t i = 0; i < views.size(); ++i)
+      ASSERT_EQ(results[i], ct.lookup(views[i]));
+  }
+}
+
 TEST_F(ctrie_tests, ConcurrentInsertsAndRemoves)
 {
   auto length_adder = [this](const unsigned len) {
@@ -175,14 +276,6 @@ TEST_F(ctrie_tests, SingleThreadedInsertsAndRemoves)
 
 TEST_F(ctrie_tests, Snapshots) {
   otf_ctrie ss = ct.snapshot();
-
-  mt()->set_root_callback([&ss, this]() {
-      list<void*> ss_and_ct_roots = ss.ct_callback();
-      ss_and_ct_roots.append(ct.ct_callback());
-
-      return ss_and_ct_roots;
-    });
-
   for(char c = 'a'; c <= 'z'; ++c) {
     for(int i = 1; i < 65; ++i) {
       auto ptr = ss.lookup(ctrie_string(i, c));
@@ -205,6 +298,498 @@ TEST_F(ctrie_tests, Snapshots) {
     }
 }
 
+TEST_F(ctrie_tests, VisitorTracingReachesEverySnode)
+{
+  using namespace otf_gc::impl_details;
+
+  std::vector<void*> gray;
+  std::unordered_set<void*> marked;
+  size_t snodes = 0;
+
+  auto push = [&gray](void* q) { gray.push_back(q); };
+  derived_ptr_visitor visit(push);
+
+  gray.push_back(ct.root_ptr());
+
+  while(!gray.empty()) {
+    void* p = gray.back();
+    gray.pop_back();
+
+    if(!p || !marked.insert(p).second)
+      continue;
+
+    auto hp = reinterpret_cast<header_t*>(reinterpret_cast<std::ptrdiff_t>(p) - header_size);
+    auto h  = hp->load(std::memory_order_relaxed);
+
+    if(((h & header_tag_mask) >> color_bits) == static_cast<uint8_t>(ctrie_internal_types::Snode_t))
+      ++snodes;
+
+    otf_ctrie_tracer::visit_derived_ptrs(h, p, visit);
+  }
+
+  ASSERT_EQ(snodes, 26u * 64u);
+}
+
+TEST_F(ctrie_tests, ShortKeysAreStoredInline)
+{
+  using namespace otf_gc::impl_details;
+
+  auto tag = [](ctrie_internal_types t) { return static_cast<size_t>(t); };
+
+  for(unsigned lenn = 0; lenn < 64; ++lenn) {
+    ctrie_string key(lenn, 'i');
+    ctrie_string copy(key);
+
+    ASSERT_EQ(key.inlined(), lenn <= OTF_CTRIE_INLINE_KEY_LEN);
+    ASSERT_EQ(copy.size(), lenn);
+    ASSERT_TRUE(copy == key);
+    ASSERT_EQ(local_hash<ctrie_string>()(copy), local_hash<ctrie_string>()(key));
+    ASSERT_EQ(std::string(copy.data()), std::string(lenn, 'i'));
+  }
+
+  gc_totals before = gc_stats::totals();
+
+  for(int i = 0; i < 100; ++i)
+    ct.insert(ctrie_string(std::to_string(i).c_str()), i);
+
+  gc_totals after = gc_stats::totals();
+
+  ASSERT_EQ(after.types[tag(ctrie_internal_types::SV_t)].objects_allocated,
+	    before.types[tag(ctrie_internal_types::SV_t)].objects_allocated);
+
+  for(int i = 0; i < 100; ++i) {
+    auto ptr = ct.lookup(std::string_view(std::to_string(i)));
+
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(*ptr, i);
+  }
+
+  // the tracer skips inline keys, which are part of their snode.
+  std::vector<void*> gray { ct.root_ptr() };
+  std::unordered_set<void*> marked;
+  size_t strings = 0;
+
+  while(!gray.empty()) {
+    void* p = gray.back();
+    gray.pop_back();
+
+    if(!p || !marked.insert(p).second)
+      continue;
+
+    auto h = reinterpret_cast<header_t*>(reinterpret_cast<std::ptrdiff_t>(p) - header_size)->load();
+
+    if(type_tag_of(p) == ctrie_internal_types::SV_t)
+      ++strings;
+
+    otf_ctrie_tracer::visit_derived_ptrs(h, p, [&gray](void* q) {
+	gray.push_back(q);
+      });
+  }
+
+  // only the fixture's keys longer than the inline length.
+  ASSERT_EQ(strings, 26u * (64u - std::min(64u, unsigned(OTF_CTRIE_INLINE_KEY_LEN))));
+}
+
+TEST(ctrie_bits, PositionsMatchMaskedPopcounts)
+{
+  using bits = ctrie_bits<5>;
+
+  for(uint64_t i = 1; i < 1000; ++i) {
+    uint64_t bmp = local_hash<uint64_t>()(i);
+
+    for(unsigned idx = 0; idx < 32; ++idx)
+      ASSERT_EQ(bits::position(uint32_t(bmp), idx),
+		unsigned(__builtin_popcount(uint32_t(bmp) & ((uint32_t(1) << idx) - 1))));
+
+    ASSERT_EQ(bits::index(bmp, 10), (bmp >> 10) & 31);
+  }
+}
+
+TEST_F(ctrie_tests, WideRootInsertsLookupsAndRemoves)
+{
+  {
+    otf_wide_ctrie<8> wct;
+
+    for(unsigned lenn = 1; lenn < 300; ++lenn)
+      for(char c = 'a'; c <= 'z'; ++c)
+	wct.insert(ctrie_string(lenn, c), lenn);
+
+    for(unsigned lenn = 1; lenn < 300; ++lenn)
+      for(char c = 'a'; c <= 'z'; ++c) {
+	auto ptr = wct.lookup(ctrie_string(lenn, c));
+
+	ASSERT_NE(ptr, nullptr);
+	ASSERT_EQ(*ptr, int(lenn));
+      }
+
+    for(char c = 'a'; c <= 'z'; ++c)
+      ASSERT_NE(wct.remove(std::string(40, c)), nullptr);
+
+    for(char c = 'a'; c <= 'z'; ++c) {
+      ASSERT_EQ(wct.lookup(std::string(40, c)), nullptr);
+      ASSERT_NE(wct.lookup(std::string(41, c)), nullptr);
+    }
+  }
+
+  // a subtrie looks keys up by the hash that picked it.
+  local_hash<ctrie_string> hash;
+
+  for(int i = 0; i < 300; ++i) {
+    ctrie_string key(("subtrie-lookup-" + std::to_string(i)).c_str());
+    ctrie_string absent(("subtrie-absent-" + std::to_string(i)).c_str());
+
+    ct.insert(key, i);
+
+    auto ptr = ct.lookup(key, hash(key));
+
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(*ptr, i);
+    ASSERT_EQ(ct.lookup(absent, hash(absent)), nullptr);
+  }
+}
+
+TEST_F(ctrie_tests, CachedHashesMatchUncached)
+{
+  local_hash<ctrie_string> hash;
+  local_hash<hashed_ctrie_string> cached_hash;
+
+  for(unsigned lenn = 1; lenn < 2500; lenn += 7) {
+    ctrie_string key(lenn, 'q');
+    hashed_ctrie_string cached_key(lenn, 'q');
+
+    ASSERT_EQ(hash(key), cached_hash(cached_key));
+    ASSERT_EQ(cached_hash(cached_key), cached_hash(hashed_ctrie_string(cached_key)));
+    ASSERT_TRUE(cached_key == hashed_ctrie_string(lenn, 'q'));
+    ASSERT_FALSE(cached_key == hashed_ctrie_string(lenn, 'r'));
+  }
+}
+
+TEST_F(ctrie_tests, ParallelSnapshotTraversal)
+{
+  otf_ctrie ss = ct.snapshot();
+
+  std::atomic<size_t> entries(0);
+
+  parallel_for_each(ss, [&entries](const ctrie_string&, const int&) {
+      entries.fetch_add(1, std::memory_order_relaxed);
+    });
+
+  ASSERT_EQ(entries.load(), 26u * 64u);
+
+  long sum = parallel_map_reduce(ss,
+				 [](const ctrie_string&, const int& v) { return long(v); },
+				 [](long a, long b) { return a + b; },
+				 0L);
+
+  ASSERT_EQ(sum, 26L * (64L * 65L / 2));
+}
+
+TEST_F(ctrie_tests, SnapshotViews) {
+  otf_ctrie_view ss = ct.snapshot_view();
+  for(unsigned lenn = 65; lenn < 2500; lenn += 10)
+    for(char c = 'a'; c <= 'z'; ++c)
+      ct.insert(ctrie_string(lenn, c), lenn);
+
+  for(char c = 'a'; c <= 'z'; ++c)
+    ct.remove(ctrie_string(1, c));
+
+  for(char c = 'a'; c <= 'z'; ++c) {
+    for(int i = 1; i < 65; ++i) {
+      auto ptr = ss.lookup(ctrie_string(i, c));
+
+      ASSERT_NE(ptr, nullptr);
+      ASSERT_EQ(*ptr, i);
+    }
+  }
+
+  for(unsigned lenn = 65; lenn < 2500; lenn += 10)
+    for(char c = 'a'; c <= 'z'; ++c)
+      ASSERT_EQ(ss.lookup(ctrie_string(lenn, c)), nullptr);
+
+  std::atomic<size_t> entries(0);
+
+  parallel_for_each(ss, [&entries](const ctrie_string&, const int&) {
+      entries.fetch_add(1, std::memory_order_relaxed);
+    });
+
+  ASSERT_EQ(entries.load(), 26u * 64u);
+}
+
+TEST_F(ctrie_tests, GcStatsCountAllocationsAndPolls)
+{
+  auto tag = [](ctrie_internal_types t) { return static_cast<size_t>(t); };
+  gc_totals before = gc_stats::totals();
+
+  for(int i = 0; i < 100; ++i)
+    ct.insert(ctrie_string(("gc-stats-key-longer-than-inline-" + std::to_string(i)).c_str()), i);
+
+  gc_totals after = gc_stats::totals();
+
+  auto& sn_before = before.types[tag(ctrie_internal_types::Snode_t)];
+  auto& sn_after = after.types[tag(ctrie_internal_types::Snode_t)];
+  auto& sv_before = before.types[tag(ctrie_internal_types::SV_t)];
+  auto& sv_after = after.types[tag(ctrie_internal_types::SV_t)];
+
+  ASSERT_GE(sn_after.objects_allocated - sn_before.objects_allocated, 100u);
+  ASSERT_GE(sn_after.bytes_allocated - sn_before.bytes_allocated, 100u * impl_details::header_size);
+  ASSERT_GE(sv_after.objects_allocated - sv_before.objects_allocated, 100u);
+  ASSERT_GE(after.polls - before.polls, 100u);
+
+  std::ostringstream os;
+  gc_stats::write_prometheus(os, after);
+
+  ASSERT_NE(os.str().find("otf_gc_objects_allocated_total{type=\"snode\"} "), std::string::npos);
+  ASSERT_NE(os.str().find("otf_gc_objects_marked_total{type=\"cnode\"} "), std::string::npos);
+
+  ASSERT_NE(os.str().find("otf_gc_phase_seconds_total{phase=\"mark\"} "), std::string::npos);
+
+  namespace fs = std::filesystem;
+
+  std::string dir = (fs::temp_directory_path() / "test-otf-ctrie-XXXXXX").string();
+  ASSERT_NE(mkdtemp(&dir[0]), nullptr);
+
+  struct remove_dir
+  {
+    fs::path p;
+
+    ~remove_dir()
+    {
+      std::error_code ec;
+      fs::remove_all(p, ec);
+    }
+  } cleanup { dir };
+
+  const std::string path = (cleanup.p / "gc-stats.prom").string();
+
+  ASSERT_TRUE(gc_stats::dump_prometheus(path));
+
+  std::ifstream in(path);
+  std::string first_line;
+
+  ASSERT_TRUE(std::getline(in, first_line));
+  ASSERT_EQ(first_line, "# TYPE otf_gc_cycles_total counter");
+}
+
+TEST_F(ctrie_tests, GcStatsCountCycles)
+{
+  uint64_t cycles = gc_stats::totals().cycles;
+
+  for(int i = 0; i < 100; ++i)
+    ct.insert(ctrie_string(("gc-stats-cycle-key-" + std::to_string(i)).c_str()), i);
+
+  // the collector takes this thread's roots in each cycle, and the
+  // second collect's cycle closes the first's.
+  collect();
+  collect();
+
+  ASSERT_GT(gc_stats::totals().cycles, cycles);
+  ASSERT_EQ(gc_stats::last_cycle().cycles, 1u);
+}
+
+TEST_F(ctrie_tests, LogCopiesMatchTheirObjects)
+{
+  using namespace impl_details;
+
+  void* in = ct.root_ptr();
+  auto h = reinterpret_cast<header_t*>(reinterpret_cast<char*>(in) - header_size)->load();
+
+  size_t n = otf_ctrie_tracer::size_of(h);
+
+  void* first = otf_ctrie_tracer::copy_obj(h, in);
+  void* second = otf_ctrie_tracer::copy_obj(h, in);
+
+  ASSERT_EQ(reinterpret_cast<header_t*>(reinterpret_cast<char*>(first) - header_size)->load(), h);
+  ASSERT_EQ(std::memcmp(first, in, n), 0);
+  ASSERT_EQ(std::memcmp(second, in, n), 0);
+}
+
+TEST(log_arena, BumpAllocatesUntilTheSecondCycleEnded)
+{
+  const size_t align = alignof(std::max_align_t);
+
+  log_arena arena;
+
+  char* first = static_cast<char*>(arena.allocate(24));
+  char* second = static_cast<char*>(arena.allocate(24));
+
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(first) % align, 0u);
+  ASSERT_EQ(second - first, static_cast<ptrdiff_t>((24 + align - 1) & ~(align - 1)));
+
+  std::memset(first, 0xab, 24);
+  std::memset(second, 0xcd, 24);
+
+  // larger than a chunk.
+  char* large = static_cast<char*>(arena.allocate(1 << 17));
+
+  ASSERT_NE(large, nullptr);
+  std::memset(large, 0xef, 1 << 17);
+
+  // the next cycle may still mark from copies made before it took its
+  // roots, so they outlive one cycle_ended.
+  arena.cycle_ended();
+
+  ASSERT_EQ(static_cast<unsigned char>(first[23]), 0xabu);
+  ASSERT_EQ(static_cast<unsigned char>(second[23]), 0xcdu);
+
+  // allocation moves on to a chunk of the new cycle.
+  char* after = static_cast<char*>(arena.allocate(24));
+
+  ASSERT_NE(after, nullptr);
+  ASSERT_NE(after, second + ((24 + align - 1) & ~(align - 1)));
+  std::memset(after, 0, 24);
+
+  arena.cycle_ended();
+
+  ASSERT_EQ(*after, 0);
+}
+
+TEST_F(ctrie_tests, FreshObjectsSkipLogCopies)
+{
+  using namespace impl_details;
+
+  void* in = ct.root_ptr();
+  auto h = reinterpret_cast<header_t*>(reinterpret_cast<char*>(in) - header_size)->load();
+
+  fresh_objects::clear();
+
+  uint64_t elided = gc_stats::totals().log_copies_elided;
+
+  log_ptr_t* slot = otf_ctrie_tracer::log_ptr(h, in, 0);
+
+  ASSERT_FALSE(fresh_objects::contains(in));
+  ASSERT_NE(slot, fresh_objects::logged_slot());
+  ASSERT_EQ(gc_stats::totals().log_copies_elided, elided);
+
+  // as though this thread had just allocated it, the barrier is handed a
+  // slot already logged, and so copies nothing.
+  fresh_objects::allocated(in);
+
+  ASSERT_TRUE(fresh_objects::contains(in));
+  ASSERT_EQ(otf_ctrie_tracer::log_ptr(h, in, 0), fresh_objects::logged_slot());
+  ASSERT_NE(fresh_objects::logged_slot()->load(), nullptr);
+  ASSERT_EQ(gc_stats::totals().log_copies_elided, elided + 1);
+
+  // fresh objects are forgotten once a cycle goes by, however the
+  // handshakes were answered, or once enough others have been allocated
+  // since.
+  collect();
+  ASSERT_FALSE(fresh_objects::contains(in));
+  ASSERT_EQ(otf_ctrie_tracer::log_ptr(h, in, 0), slot);
+
+  fresh_objects::allocated(in);
+
+  for(int i = 0; i < 8; ++i)
+    fresh_objects::allocated(&h);
+
+  ASSERT_FALSE(fresh_objects::contains(in));
+
+  fresh_objects::clear();
+}
+
+TEST(gc_pacer, UnthrottledBelowTheSoftLimit)
+{
+  gc_pacing old = gc_pacer::pacing();
+  gc_pacing p = old;
+
+  // far above anything the tests allocate, so each sample finds the
+  // heap under it.
+  p.soft_limit_bytes = uint64_t(1) << 60;
+  gc_pacer::configure(p);
+
+  size_t polls = 0;
+
+  for(unsigned i = 0; i < 4 * gc_pacer::throttle_interval; ++i)
+    gc_pacer::throttle([&polls]() { ++polls; });
+
+  gc_pacer::configure(old);
+
+  ASSERT_EQ(polls, 0u);
+}
+
+TEST_F(ctrie_tests, ThrottledOverTheSoftLimit)
+{
+  if(!OTF_CTRIE_GC_STATS)
+    return;
+
+  gc_pacing old = gc_pacer::pacing();
+  gc_pacing p = old;
+
+  // the fixture's trie alone is over a one byte limit.
+  p.soft_limit_bytes = 1;
+  p.max_assist_wait = std::chrono::microseconds(500);
+  gc_pacer::configure(p);
+
+  size_t polls = 0;
+
+  auto start = gc_stats::clock::now();
+
+  // the heap is sampled within throttle_interval polls, and once it's
+  // found over the limit, on every poll after.
+  for(unsigned i = 0; i < gc_pacer::throttle_interval + 1; ++i)
+    gc_pacer::throttle([&polls]() {
+	++polls;
+	mt()->poll_for_sync();
+      });
+
+  auto waited = gc_stats::clock::now() - start;
+
+  gc_pacer::configure(old);
+
+  ASSERT_GT(polls, 0u);
+  ASSERT_GE(waited, p.max_assist_wait);
+}
+
+TEST_F(ctrie_tests, RootRegistryListsLiveCtriesAndSnapshots)
+{
+  const auto& registry = root_registry::local();
+  const size_t base = registry->size();
+
+  auto registered = [&registry]() {
+    std::unordered_set<void*> roots;
+
+    for(void* p : registry->ct_callback())
+      roots.insert(p);
+
+    return roots;
+  };
+
+  {
+    otf_ctrie other;
+    otf_ctrie ss = ct.snapshot();
+    otf_ctrie_view view = ct.snapshot_view();
+
+    ASSERT_EQ(registry->size(), base + 3);
+
+    auto roots = registered();
+
+    for(void* p : { ct.root_ptr(), other.root_ptr(), ss.root_ptr(), view.root_ptr() })
+      ASSERT_EQ(roots.count(p), 1u);
+  }
+
+  ASSERT_EQ(registry->size(), base);
+
+  std::vector<std::unique_ptr<otf_ctrie>> tries;
+
+  for(int i = 0; i < 64; ++i)
+    tries.emplace_back(new otf_ctrie(ct.snapshot()));
+
+  // dropping every other one moves slots from the end into the gaps.
+  for(size_t i = 0; i < tries.size(); i += 2)
+    tries[i].reset();
+
+  ASSERT_EQ(registry->size(), base + 32);
+
+  auto roots = registered();
+
+  for(size_t i = 1; i < tries.size(); i += 2)
+    ASSERT_EQ(roots.count(tries[i]->root_ptr()), 1u);
+
+  tries.clear();
+
+  ASSERT_EQ(registry->size(), base);
+  ASSERT_EQ(registered().count(ct.root_ptr()), 1u);
+}
+
 int main(int argc, char** argv)
 {
   gc::initialize();
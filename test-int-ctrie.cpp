@@ -0,0 +1,152 @@
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "otf_ctrie.hpp"
+#include "parallel_traversal.hpp"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// A collector traces the one ctrie instantiation it was started with, so
+// integer keys are tested in a binary of their own rather than alongside
+// the ctrie_string tests.
+using int_ctrie        = basic_otf_ctrie<uint64_t, uint64_t>;
+using int_ctrie_policy = basic_otf_ctrie_policy<uint64_t, uint64_t>;
+using int_ctrie_tracer = basic_otf_ctrie_tracer<uint64_t, uint64_t>;
+
+static const uint64_t num_keys = 1 << 14;
+
+TEST(int_ctrie, InsertLookupAndRemove)
+{
+  int_ctrie ct;
+
+  for(uint64_t i = 0; i < num_keys; ++i)
+    ct.insert(i, i * i);
+
+  for(uint64_t i = 0; i < num_keys; ++i) {
+    auto ptr = ct.lookup(i);
+
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(*ptr, i * i);
+  }
+
+  ASSERT_EQ(ct.lookup(num_keys), nullptr);
+
+  for(uint64_t i = 0; i < num_keys; i += 2) {
+    auto ptr = ct.remove(i);
+
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(*ptr, i * i);
+  }
+
+  for(uint64_t i = 0; i < num_keys; ++i)
+    ASSERT_EQ(ct.lookup(i) == nullptr, i % 2 == 0);
+
+  ASSERT_EQ(ct.remove(0), nullptr);
+}
+
+TEST(int_ctrie, OverwritesInPlace)
+{
+  int_ctrie ct;
+
+  ct.insert(7, 1);
+  ct.insert(7, 2);
+
+  auto ptr = ct.lookup(7);
+
+  ASSERT_NE(ptr, nullptr);
+  ASSERT_EQ(*ptr, 2u);
+}
+
+TEST(int_ctrie, SnapshotsOutliveWrites)
+{
+  int_ctrie ct;
+
+  for(uint64_t i = 0; i < num_keys; ++i)
+    ct.insert(i, i);
+
+  int_ctrie ss = ct.snapshot();
+  auto view = ct.snapshot_view();
+
+  for(uint64_t i = 0; i < num_keys; ++i) {
+    ct.remove(i);
+    ct.insert(num_keys + i, i);
+  }
+
+  for(uint64_t i = 0; i < num_keys; ++i) {
+    ASSERT_EQ(ct.lookup(i), nullptr);
+    ASSERT_EQ(ss.lookup(num_keys + i), nullptr);
+    ASSERT_EQ(view.lookup(num_keys + i), nullptr);
+
+    auto ptr = ss.lookup(i);
+
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(*ptr, i);
+
+    ptr = view.lookup(i);
+
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(*ptr, i);
+  }
+
+  std::atomic<uint64_t> count(0), sum(0);
+
+  parallel_for_each(view, [&](const uint64_t& k, const uint64_t& v) {
+      ASSERT_EQ(k, v);
+      count.fetch_add(1, std::memory_order_relaxed);
+      sum.fetch_add(k, std::memory_order_relaxed);
+    }, 4);
+
+  ASSERT_EQ(count.load(), num_keys);
+  ASSERT_EQ(sum.load(), num_keys * (num_keys - 1) / 2);
+}
+
+TEST(int_ctrie, InterleavedLookupsMatchLookups)
+{
+  int_ctrie ct;
+
+  for(uint64_t i = 0; i < num_keys; i += 3)
+    ct.insert(i, i + 1);
+
+  std::vector<uint64_t> keys;
+
+  for(uint64_t i = 0; i < num_keys; ++i)
+    keys.push_back(i);
+
+  std::vector<const uint64_t*> results(keys.size());
+  ct.lookup_many_interleaved(keys.begin(), keys.end(), results.begin());
+
+  for(uint64_t i = 0; i < num_keys; ++i) {
+    if(i % 3 == 0) {
+      ASSERT_NE(results[i], nullptr);
+      ASSERT_EQ(*results[i], i + 1);
+    } else {
+      ASSERT_EQ(results[i], nullptr);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  gc::initialize();
+
+  std::future<void> collector_thread = std::async([]() {
+      gc::collector->template run<int_ctrie_policy, int_ctrie_tracer>();
+    });
+
+  ::testing::InitGoogleTest(&argc, argv);
+
+  for(int i = 0; i < 8; ++i)
+    RUN_ALL_TESTS();
+
+  mt().reset();
+
+  gc::collector->stop();
+  collector_thread.get();
+  gc::collector->template destroy<int_ctrie_policy>();
+
+  return 0;
+}